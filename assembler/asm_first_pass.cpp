@@ -1,47 +1,370 @@
 #include "assembler.h"
 #include "utils.h"
 
-bool Assembler::asm_first_pass(const std::list<std::string>& lines)
+// Sources below this are analyzed on the calling thread
+static const size_t PARALLEL_MIN_LINES = 32 * 1024;
+static const size_t CHUNK_LINES = 8 * 1024;
+// Queue blocks analyzed together per thread before they are merged
+static const size_t WAVE_BLOCKS_PER_THREAD = 4;
+
+bool Assembler::asm_first_pass(const SourceText& lines)
 {
 	qprintf(verbose, 2, __func__);
 
 	line_num = 1;
 	bool result = true;
 
-	for (const auto& line : lines)
+	unsigned threads = threadCount();
+
+	if (threads == 1 || lines.size() < PARALLEL_MIN_LINES)
 	{
-		if (line.empty())
+		for (std::string_view line : lines)
 		{
-			line_num++;
-			continue;
+			if (!analyzeLine(line))
+				result = false;
 		}
 
-		if (isLabel(line, false))
+		return layoutBlocks(result);
+	}
+
+	std::vector<FirstPassChunk> chunks((lines.size() + CHUNK_LINES - 1) / CHUNK_LINES);
+
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		chunks[i].text = &lines;
+		chunks[i].begin = i * CHUNK_LINES;
+		chunks[i].end = std::min(lines.size(), chunks[i].begin + CHUNK_LINES);
+		chunks[i].first_line = static_cast<int>(chunks[i].begin) + 1;
+	}
+
+	result = analyzeChunks(chunks, threads);
+
+	return layoutBlocks(result);
+}
+
+bool Assembler::asm_first_pass(LineQueue& input)
+{
+	qprintf(verbose, 2, __func__);
+
+	line_num = 1;
+	bool result = true;
+
+	std::string block;
+	SourceText lines;
+
+	// the image is written in source order while parsing, so streaming stays serial
+	unsigned threads = rom_file ? 1 : threadCount();
+	bool chunked = !rom_file && (threads > 1 || chunk_cache);
+
+	if (chunked)
+	{
+		// blocks are analyzed in waves, so only a wave of text is held at a time
+		bool more = true;
+
+		while (more)
 		{
-			if (!analyzeLabel(line))
+			std::vector<FirstPassChunk> wave(threads * WAVE_BLOCKS_PER_THREAD);
+			size_t used = 0;
+
+			while (used < wave.size() && (more = input.pop(block)))
+			{
+				FirstPassChunk& chunk = wave[used++];
+				chunk.owned.assign(std::move(block));
+				chunk.text = &chunk.owned;
+				chunk.begin = 0;
+				chunk.end = chunk.owned.size();
+				chunk.first_line = line_num;
+				line_num += static_cast<int>(chunk.owned.size());
+			}
+
+			wave.resize(used);
+			if (!analyzeChunks(wave, threads))
 				result = false;
 		}
-		else if (isInstruction(line))
+	}
+
+	// blocks hold whole lines, so they are split and analyzed one by one
+	while (!chunked && input.pop(block))
+	{
+		lines.assign(std::move(block));
+
+		for (std::string_view line : lines)
 		{
-			if (!analyzeInstruction(line))
+			if (!analyzeLine(line))
 				result = false;
 		}
-		else if (isDirective(line))
+	}
+
+	// the producer failed, its errors are the ones to report
+	if (!input.ok())
+		return false;
+
+	return layoutBlocks(result);
+}
+
+bool Assembler::analyzeLine(std::string_view line)
+{
+	if (line.empty())
+	{
+		line_num++;
+		return true;
+	}
+
+	bool result = true;
+
+	TokenList tokens;
+	AssemblerDirective directive;
+
+	tokenize(line, tokens);
+
+	if (isLabelDeclaration(tokens))
+	{
+		if (!analyzeLabel(line, tokens))
+			result = false;
+	}
+	else if (isInstruction(tokens))
+	{
+		if (!analyzeInstruction(line, tokens))
+			result = false;
+	}
+	else if (isDirective(tokens, directive))
+	{
+		if (!analyzeDirective(line, directive))
+			result = false;
+	}
+	else
+	{
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_TOKEN, " What the fuck is this ? " + std::string(line), line_num);
+		result = false;
+	}
+	line_num++;
+
+	return result;
+}
+
+unsigned Assembler::threadCount() const
+{
+	if (pool)
+		return pool->size();
+	return worker_threads ? worker_threads : defaultThreadCount();
+}
+
+void Assembler::runTasks(size_t count, unsigned threads, const std::function<void(size_t)>& task)
+{
+	if (pool)
+		pool->run(count, task);
+	else
+		parallelFor(count, threads, task);
+}
+
+bool Assembler::analyzeChunks(std::vector<FirstPassChunk>& chunks, unsigned threads)
+{
+	qprintf(verbose, 2, "%s: %zu chunks on %u threads", __func__, chunks.size(), threads);
+
+	runTasks(chunks.size(), threads, [&](size_t i) {
+		FirstPassChunk& chunk = chunks[i];
+
+		// only queue blocks are whole texts of their own to compare
+		if (chunk_cache && chunk.text == &chunk.owned)
+			chunk.analysis = chunk_cache->get(chunk.owned.text(), chunk.first_line, ROM_SIZE, [&]() { return analyzeChunk(chunk); });
+		else
+			chunk.analysis = analyzeChunk(chunk);
+	});
+
+	bool result = true;
+
+	for (auto& chunk : chunks)
+	{
+		if (!mergeChunk(chunk))
+			result = false;
+		chunk.analysis.reset();
+	}
+
+	return result;
+}
+
+// Runs on a worker - the chunk is analyzed by a scratch assembler as if
+// it were a whole source, except that lines before its first label go
+// into the `inherited` stand-in block
+std::shared_ptr<const Assembler::ChunkAnalysis> Assembler::analyzeChunk(const FirstPassChunk& chunk) const
+{
+	auto analysis = std::make_shared<ChunkAnalysis>();
+	analysis->part = std::make_unique<Assembler>();
+
+	Assembler& part = *analysis->part;
+	part.clear();
+	part.verbose = verbose;
+	part.ROM_SIZE = ROM_SIZE;
+	part.prefetch = prefetch;
+	part.curBlock = &analysis->inherited;
+	part.line_num = chunk.first_line;
+
+	for (size_t i = chunk.begin; i < chunk.end; i++)
+	{
+		std::string_view line = (*chunk.text)[i];
+
+		if (!part.analyzeLine(line))
+			analysis->result = false;
+
+		if (part.curBlock == &analysis->inherited && !line.empty())
+			analysis->orphan_lines++;
+	}
+
+	return analysis;
+}
+
+// Appends a chunk in source order. A chunk that depended on what came
+// before it - a label declared in an earlier chunk, or lines with no open
+// block - is analyzed again here in order, so it reports exactly what the
+// serial pass does
+bool Assembler::mergeChunk(const FirstPassChunk& chunk)
+{
+	const ChunkAnalysis& analysis = *chunk.analysis;
+	const Assembler& part = *analysis.part;
+	bool conflict = analysis.orphan_lines && !curBlock;
+
+	io_wait += part.io_wait;
+
+	// chunk symbol id -> id here
+	std::vector<int> ids(part.symbols.size());
+	for (size_t i = 0; i < ids.size(); i++)
+		ids[i] = symbols.intern(part.symbols.name(static_cast<int>(i)));
+
+	for (const auto& block : part.blocks)
+	{
+		if (block_by_label.get(ids[block.label_id]))
+			conflict = true;
+	}
+
+	if (conflict)
+	{
+		qprintf(verbose, 2, "%s: lines %d-%d again in order", __func__, chunk.first_line, chunk.first_line + static_cast<int>(chunk.end - chunk.begin) - 1);
+
+		line_num = chunk.first_line;
+		bool result = true;
+
+		for (size_t i = chunk.begin; i < chunk.end; i++)
 		{
-			if (!analyzeDirective(line))
+			if (!analyzeLine((*chunk.text)[i]))
 				result = false;
 		}
+
+		return result;
+	}
+
+	if (analysis.orphan_lines)
+		curBlock->size += analysis.inherited.size;
+
+	// the analysis may be shared, so its blocks are copied rather than moved;
+	// list nodes do not move, so Statement::block and block_by_label stay valid
+	std::unordered_map<const Block*, Block*> copies;
+	copies.reserve(part.blocks.size());
+
+	for (const auto& block : part.blocks)
+	{
+		// the entry point block goes first, as in the serial pass
+		bool entry = part.has_entry_point && &block == &part.blocks.front();
+		Block& copy = *blocks.insert(entry ? blocks.begin() : blocks.end(), block);
+
+		copy.label_id = ids[block.label_id];
+		copy.label = symbols.name(copy.label_id);
+		block_by_label.set(copy.label_id, &copy);
+		copies[&block] = &copy;
+	}
+
+	if (part.has_entry_point)
+		has_entry_point = true;
+
+	size_t data_base = data_pool.size();
+
+	for (Statement st : part.statements)
+	{
+		if (st.kind == STMT_LABEL)
+			st.block = copies[st.block];
+		if (st.kind == STMT_DATA)
+			st.data_offset += data_base;
+		if (st.label_ref >= 0)
+			st.label_ref = ids[st.label_ref];
+		statements.push_back(st);
+	}
+
+	data_pool.insert(data_pool.end(), part.data_pool.begin(), part.data_pool.end());
+	binary_files.insert(binary_files.end(), part.binary_files.begin(), part.binary_files.end());
+
+	errors.append(part.errors);
+
+	if (part.curBlock != &analysis.inherited)
+		curBlock = copies[part.curBlock];
+	line_num = part.line_num;
+
+	return analysis.result;
+}
+
+Assembler::ChunkCache::ChunkCache()
+	: hit_count(0)
+	, miss_count(0)
+{
+}
+
+Assembler::ChunkCache::Analysis Assembler::ChunkCache::get(const std::string& text, int first_line, int rom_size, const std::function<Analysis()>& analyze)
+{
+	uint64_t key = content_hash(text);
+	std::promise<Analysis> promise;
+	std::shared_future<Analysis> found;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto range = entries.equal_range(key);
+		for (auto it = range.first; it != range.second && !found.valid(); it++)
+		{
+			const Entry& entry = it->second;
+			if (entry.first_line == first_line && entry.rom_size == rom_size && entry.text == text)
+				found = entry.analysis;
+		}
+
+		if (found.valid())
+		{
+			hit_count++;
+		}
 		else
 		{
-			error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_TOKEN, " What the fuck is this ? " + line, line_num);
-			result = false;
+			entries.emplace(key, Entry{ text, first_line, rom_size, promise.get_future().share() });
+			miss_count++;
 		}
-		line_num++;
 	}
 
+	// the assembler analyzing it is running, so waiting cannot block it
+	if (found.valid())
+		return found.get();
+
+	Analysis analysis = analyze();
+	promise.set_value(analysis);
+
+	return analysis;
+}
+
+size_t Assembler::ChunkCache::hits() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return hit_count;
+}
+
+size_t Assembler::ChunkCache::misses() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return miss_count;
+}
+
+// Addresses of the blocks and the overlap check, after all lines are analyzed
+bool Assembler::layoutBlocks(bool result)
+{
+	if (!binary_files.empty())
+		qprintf(verbose, 1, "INCLUDE_BIN I/O: %zu files, %.2f ms waiting for them", binary_files.size(), io_wait * 1000);
+
 	if (!has_entry_point)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_NO_ENTRY_POINT, {}, -1, true);
+		errors.addError(ErrorLog::ASSEMBLER_NO_ENTRY_POINT, {}, -1, true);
 		result = false;
 	}
 
@@ -56,7 +379,7 @@ bool Assembler::asm_first_pass(const std::list<std::string>& lines)
 
 			if (cur_address >= ROM_SIZE)
 			{
-				error_log.addError(ErrorLog::ASSEMBLER_ROM_OVERFLOW, block.label, -1, true);
+				errors.addError(ErrorLog::ASSEMBLER_ROM_OVERFLOW, block.label, -1, true);
 				result = false;
 				break;
 			}
@@ -65,263 +388,528 @@ bool Assembler::asm_first_pass(const std::list<std::string>& lines)
 
 		total_size = cur_address;
 
-		if (blocks.size() > 1)
-		{
-			for (auto it1 = blocks.begin(); it1 != blocks.end(); ++it1)
-			{
-				const Block& b1 = *it1;
-
-				if (b1.size <= 0)
-					continue;
-
-				for (auto it2 = std::next(it1); it2 != blocks.end(); ++it2)
-				{
-					const Block& b2 = *it2;
-
-					if (b2.size <= 0)
-						continue;
-
-					if (is_intersect(b1.base_address, b1.size, b2.base_address, b2.size))
-					{
-						std::stringstream ss;
-						ss << "  " << b1.label << ": 0x" << std::hex << b1.base_address
-							<< " - 0x" << b1.base_address + b1.size - 1 << std::endl
-							<< "  " << b2.label << ": 0x" << std::hex << b2.base_address
-							<< " - 0x" << b2.base_address + b2.size - 1;
-
-						error_log.addError(ErrorLog::ASSEMBLER_BLOCKS_OVERLAP, ss.str(), -1, true);
-						result = false;
-					}
-				}
-			}
-		}
+		if (blocks.size() > 1 && !checkOverlaps())
+			result = false;
 	}
 
 	return result;
 }
 
-bool Assembler::analyzeInstruction(const std::string& line)
+// Sort and sweep - ranges sorted by start address only need to be compared
+// with the ranges still open at that address. Does not assume the blocks
+// are back to back, so it holds for blocks placed at fixed addresses too
+bool Assembler::checkOverlaps()
 {
-	qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
-
-	bool result = true;
-	std::stringstream ss(line);
-	std::string opcode;
+	struct BlockRange
+	{
+		address_t first, last;
+		size_t order;           // position in the block list
+		const Block* block;
+	};
 
-	ss >> opcode;
+	std::vector<BlockRange> ranges;
+	ranges.reserve(blocks.size());
 
-	if (!isValidInstruction(line))
+	for (const auto& block : blocks)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_INSTRUCTION, line, line_num);
-		result = false;
+		if (block.size > 0)
+			ranges.push_back({ block.base_address, block.base_address + block.size - 1, ranges.size(), &block });
 	}
 
-	if (curBlock)
+	std::sort(ranges.begin(), ranges.end(), [](const BlockRange& a, const BlockRange& b) {
+		return a.first != b.first ? a.first < b.first : a.order < b.order;
+	});
+
+	// pairs as list positions, reported in the order of the pair loop this replaces
+	std::vector<std::pair<size_t, size_t>> overlaps;
+	std::vector<const BlockRange*> open;
+
+	for (const auto& range : ranges)
 	{
-		if (result)
-			curBlock->size += getOpcodeSize(opcode);
+		open.erase(std::remove_if(open.begin(), open.end(), [&](const BlockRange* r) {
+			return r->last < range.first;
+		}), open.end());
+
+		for (const BlockRange* r : open)
+			overlaps.push_back(std::minmax(r->order, range.order));
+
+		open.push_back(&range);
 	}
-	else
+
+	if (overlaps.empty())
+		return true;
+
+	std::vector<const Block*> by_order(ranges.size());
+	for (const auto& range : ranges)
+		by_order[range.order] = range.block;
+
+	std::sort(overlaps.begin(), overlaps.end());
+
+	for (const auto& pair : overlaps)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_PLACEMENT, line, line_num);
-		result = false;
+		const Block& b1 = *by_order[pair.first];
+		const Block& b2 = *by_order[pair.second];
+
+		std::stringstream ss;
+		ss << "  " << b1.label << ": 0x" << std::hex << b1.base_address
+			<< " - 0x" << b1.base_address + b1.size - 1 << std::endl
+			<< "  " << b2.label << ": 0x" << std::hex << b2.base_address
+			<< " - 0x" << b2.base_address + b2.size - 1;
+
+		errors.addError(ErrorLog::ASSEMBLER_BLOCKS_OVERLAP, ss.str(), -1, true);
 	}
 
-	return result;
+	return false;
 }
 
-bool Assembler::analyzeDirectiveString(const std::string line)
+bool Assembler::analyzeInstruction(std::string_view line, const TokenList& tokens)
 {
-	qprintf(verbose, 4, "%s\n%s", __func__, line.c_str());
+	qprintf(verbose, 3, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
-	auto tokens = parse_directiveString(line);
+	bool result = true;
 
-	if (tokens.empty())
+	if (!isValidInstruction(tokens))
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_STRING, line, line_num);
-		return false;
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_INSTRUCTION, line, line_num);
+		result = false;
 	}
 
 	if (!curBlock)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_PLACEMENT, line, line_num);
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_PLACEMENT, line, line_num);
+		result = false;
+	}
+
+	if (!result)
 		return false;
+
+	// operands are already validated, only split them
+	Token args[3];
+	int args_num = 0;
+
+	TokenReader reader(tokens, 1);
+	Token arg;
+
+	while (reader.nextOperand(arg))
+		args[args_num++] = arg;
+
+	Statement st = {};
+	st.kind = STMT_INSTRUCTION;
+	st.line = line_num;
+	st.opcode = tokens[0].value;
+	st.label_ref = -1;
+
+	switch (args_num)
+	{
+	case 0:
+		result = analyzeNoArgsInstruction(st);
+		break;
+	case 1:
+		result = analyzeOneArgInstruction(st, args[0]);
+		break;
+	case 2:
+		result = analyzeTwoArgsInstruction(st, args[0], args[1]);
+		break;
+	case 3:
+		result = analyzeThreeArgsInstruction(st, args[0], args[1], args[2]);
+		break;
 	}
-	std::string str_content = tokens.front();
-	int byte_length = str_content.length() + 1;
-	int instruction_length = (byte_length + 1) / 2;
-	curBlock->size += instruction_length;
 
-	qprintf(verbose, 2, "String: \"%s\", length: %d bytes, instructions: %d",
-		str_content.c_str(), byte_length, instruction_length);
+	if (!result)
+		return false;
+
+	curBlock->size += getOpcodeSize(st.opcode);
+	statements.push_back(st);
 
 	return true;
 }
 
-bool Assembler::analyzeDirectiveByte(const std::string line)
+bool Assembler::analyzeNoArgsInstruction(Statement& st)
 {
-	qprintf(verbose, 4, "%s\n%s", __func__, line.c_str());
-	auto tokens = parse_directiveData(line);
-	if (!curBlock)
+	switch (st.opcode)
+	{
+	case OPCODE_NOP:
+	case OPCODE_HLT:
+		break;
+	default:
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_INSTRUCTION, " Unsupported no-argument instruction ", line_num);
+		return false;
+	}
+
+	return true;
+}
+
+bool Assembler::analyzeOneArgInstruction(Statement& st, const Token& arg1)
+{
+	switch (st.opcode)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_PLACEMENT, line, line_num);
+	case OPCODE_JPR:
+	case OPCODE_JPC:
+	case OPCODE_JOV:
+	case OPCODE_JZD:
+		st.rs = arg1.value;
+		break;
+	case OPCODE_LPC:
+		st.rd = arg1.value;
+		break;
+	default:
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_INSTRUCTION,
+			" Unsupported one-argument instruction ", line_num);
 		return false;
 	}
-	for (const auto& token : tokens)
+
+	return true;
+}
+
+bool Assembler::analyzeTwoArgsInstruction(Statement& st, const Token& arg1, const Token& arg2)
+{
+	int reg1num = arg1.value;
+
+	switch (st.opcode)
 	{
-		int value;
-		if (!isValue8(token, value))
+	case OPCODE_LWI:
+
+		st.rd = reg1num;
+
+		// label is resolved in the second pass, when addresses are known
+		if (!isValue16(arg2.text, st.imm))
 		{
-			error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_IMM_VALUE, line, line_num);
-			return false;
+			st.label_ref = symbols.intern(arg2.text);
 		}
+
+		break;
+
+	case OPCODE_TCP:
+	case OPCODE_INC:
+	case OPCODE_DEC:
+	case OPCODE_LWD:
+	case OPCODE_NOT:
+	case OPCODE_MOV:
+	case OPCODE_JRL:
+
+		st.rd = reg1num;
+		st.rs = arg2.value;
+
+		break;
+
+	case OPCODE_SWD:
+
+		st.rt = reg1num;
+		st.rs = arg2.value;
+		break;
+
+	case OPCODE_JGZ:
+	case OPCODE_JLZ:
+	case OPCODE_JEZ:
+	case OPCODE_JNZ:
+
+		st.rs = reg1num;
+		st.rt = arg2.value;
+
+		break;
+
+	default:
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_INSTRUCTION,
+			" Unsupported two-argument instruction ", line_num);
+		return false;
 	}
-	if (tokens.empty())
+
+	return true;
+}
+
+bool Assembler::analyzeThreeArgsInstruction(
+	Statement& st,
+	const Token& arg1,
+	const Token& arg2,
+	const Token& arg3
+)
+{
+	// fortunately all 3 args instructions use only registers
+	switch (st.opcode)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, line, line_num);
+	case OPCODE_ADD:
+	case OPCODE_SUB:
+	case OPCODE_ADC:
+	case OPCODE_SBB:
+	case OPCODE_MUL:
+	case OPCODE_DIV:
+	case OPCODE_UML:
+	case OPCODE_UDV:
+	case OPCODE_MHL:
+	case OPCODE_MLH:
+	case OPCODE_MHH:
+	case OPCODE_MLL:
+	case OPCODE_SLL:
+	case OPCODE_SRL:
+	case OPCODE_SRA:
+	case OPCODE_AND:
+	case OPCODE_ORR:
+		st.rd = arg1.value;
+		st.rs = arg2.value;
+		st.rt = arg3.value;
+		break;
+
+	default:
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_INSTRUCTION, " Unsupported three-argument instruction ", line_num);
 		return false;
 	}
-	int instruction_count = (tokens.size() + 1) / 2;
-	curBlock->size += instruction_count;
-	qprintf(verbose, 3, ".byte: %zu bytes -> %d instructions", tokens.size(), instruction_count);
 
 	return true;
 }
 
-bool Assembler::analyzeDirectiveData16(const std::string line)
+void Assembler::addDataStatement(size_t data_offset)
 {
-	qprintf(verbose, 4, "%s\n%s", __func__, line.c_str());
+	Statement st = {};
+	st.kind = STMT_DATA;
+	st.line = line_num;
+	st.label_ref = -1;
+	st.data_offset = data_offset;
+	st.data_size = data_pool.size() - data_offset;
+
+	// streaming - the block's place in the image is already known, so the
+	// payload goes there now and only its size is kept
+	if (rom_file)
+	{
+		rom_file->write(curBlock->image_address + curBlock->size, data_pool.data() + data_offset, st.data_size);
+		data_pool.resize(data_offset);
 
-	auto tokens = parse_directiveData(line);
+		curBlock->size += static_cast<int>(st.data_size);
 
-	if (!curBlock)
+		if (!statements.empty() && statements.back().kind == STMT_DATA)
+		{
+			statements.back().data_size += st.data_size;
+			return;
+		}
+
+		st.data_offset = IN_IMAGE;
+		statements.push_back(st);
+		return;
+	}
+
+	curBlock->size += static_cast<int>(st.data_size);
+	statements.push_back(st);
+}
+
+// Packs bytes little-endian into 16-bit words, the odd tail byte is zero padded
+void Assembler::packBytes(std::string_view bytes)
+{
+	for (size_t i = 0; i < bytes.size(); i += 2)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_PLACEMENT, line, line_num);
-		return false;
+		instruction_t packed = static_cast<uint8_t>(bytes[i]);
+		if (i + 1 < bytes.size())
+			packed |= static_cast<uint8_t>(bytes[i + 1]) << 8;
+
+		data_pool.push_back(packed);
 	}
+}
+
+bool Assembler::analyzeDirectiveString(std::string_view line)
+{
+	qprintf(verbose, 4, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
-	for (const auto& token : tokens)
+	std::string_view str_content;
+
+	if (!parse_directiveString(line, str_content))
 	{
-		int value;
-		if (!isValue16(token, value))
-		{
-			error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_IMM_VALUE, line, line_num);
-			return false;
-		}
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_STRING, line, line_num);
+		return false;
 	}
 
-	if (tokens.empty())
+	if (!curBlock)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, line, line_num);
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_PLACEMENT, line, line_num);
 		return false;
 	}
 
-	curBlock->size += tokens.size();
+	size_t data_offset = data_pool.size();
+
+	std::string full_data(str_content);
+	full_data += '\0';
+	packBytes(full_data);
+
+	addDataStatement(data_offset);
+
+	qprintf(verbose, 2, "String: \"%.*s\", length: %zu bytes, instructions: %zu",
+		(int)str_content.size(), str_content.data(), full_data.size(), data_pool.size() - data_offset);
+
 	return true;
 }
 
-bool Assembler::analyzeDirectiveData32(const std::string line)
+bool Assembler::analyzeDirectiveByte(std::string_view line)
 {
-	qprintf(verbose, 4, "%s\n%s", __func__, line.c_str());
-
-	auto tokens = parse_directiveData(line);
-
+	qprintf(verbose, 4, "%s\n%.*s", __func__, (int)line.size(), line.data());
 	if (!curBlock)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_PLACEMENT, line, line_num);
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_PLACEMENT, line, line_num);
 		return false;
 	}
 
-	for (const auto& token : tokens)
+	size_t data_offset = data_pool.size();
+	int values_num = 0;
+
+	bool values_ok = parse_directiveData(line, isValue8, [&](int value) {
+		if (values_num % 2)
+			data_pool.back() |= static_cast<instruction_t>((value & 0xFF) << 8);
+		else
+			data_pool.push_back(static_cast<instruction_t>(value & 0xFF));
+		values_num++;
+	});
+
+	if (!values_ok)
 	{
-		int value;
-		if (!isValue32(token, value))
-		{
-			error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_IMM_VALUE, line, line_num);
-			return false;
-		}
+		data_pool.resize(data_offset);
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_IMM_VALUE, line, line_num);
+		return false;
 	}
-
-	if (tokens.empty())
+	if (!values_num)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, line, line_num);
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, line, line_num);
 		return false;
 	}
 
-	curBlock->size += tokens.size() * 2;
+	addDataStatement(data_offset);
+	qprintf(verbose, 3, ".byte: %d bytes -> %d instructions", values_num, (values_num + 1) / 2);
+
 	return true;
 }
 
-bool Assembler::analyzeDirectiveLoadFile(const std::string line)
+bool Assembler::analyzeDirectiveData16(std::string_view line)
 {
-	qprintf(verbose, 4, "%s\n%s", __func__, line.c_str());
-
-	auto tokens = parse_directiveLoadFile(line);
+	qprintf(verbose, 4, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
 	if (!curBlock)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_PLACEMENT, line, line_num);
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_PLACEMENT, line, line_num);
 		return false;
 	}
 
-	if (tokens.empty())
+	size_t data_offset = data_pool.size();
+
+	bool values_ok = parse_directiveData(line, isValue16, [&](int value) {
+		data_pool.push_back(static_cast<instruction_t>(value & 0xFFFF));
+	});
+
+	if (!values_ok)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, line, line_num);
+		data_pool.resize(data_offset);
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_IMM_VALUE, line, line_num);
 		return false;
 	}
 
-	std::string filename = tokens.front();
-
-	std::ifstream file(filename, std::ios::binary | std::ios::ate);
-	if (!file.is_open())
+	if (data_pool.size() == data_offset)
 	{
-		error_log.addError(ErrorLog::FILE_CANNOT_OPEN, line, line_num);
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, line, line_num);
 		return false;
 	}
 
-	std::streamsize file_size = file.tellg();
-	file.close();
+	addDataStatement(data_offset);
+	return true;
+}
+
+bool Assembler::analyzeDirectiveData32(std::string_view line)
+{
+	qprintf(verbose, 4, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
-	if (file_size < 0)
+	if (!curBlock)
 	{
-		error_log.addError(ErrorLog::FILE_CANNOT_READ, line, line_num);
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_PLACEMENT, line, line_num);
 		return false;
 	}
 
-	int instruction_count = (file_size + 1) / 2; //  
-	curBlock->size += instruction_count;
+	size_t data_offset = data_pool.size();
 
-	qprintf(verbose, 2, "Load file: %s, size: %zd bytes, aligned: %zu bytes",
-		filename.c_str(), file_size, instruction_count * 2);
+	bool values_ok = parse_directiveData(line, isValue32, [&](int value) {
+		data_pool.push_back(static_cast<instruction_t>(value & 0xFFFF));
+		data_pool.push_back(static_cast<instruction_t>((value >> 16) & 0xFFFF));
+	});
 
+	if (!values_ok)
+	{
+		data_pool.resize(data_offset);
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_IMM_VALUE, line, line_num);
+		return false;
+	}
+
+	if (data_pool.size() == data_offset)
+	{
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, line, line_num);
+		return false;
+	}
+
+	addDataStatement(data_offset);
 	return true;
 }
 
-bool Assembler::analyzeDirective(const std::string line)
+bool Assembler::analyzeDirectiveLoadFile(std::string_view line)
 {
-	qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
+	qprintf(verbose, 4, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
-	std::stringstream ss(line);
-	std::string str_directive;
+	std::string_view filename_view;
+	bool has_filename = parse_directiveLoadFile(line, filename_view);
 
-	ss >> str_directive;
-
-	std::string directive_name = str_directive;
-	if (directive_name[0] != '.') 
+	if (!curBlock)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_DIRECTIVE, line, line_num);
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_PLACEMENT, line, line_num);
 		return false;
 	}
 
-	directive_name = directive_name.substr(1);
-	auto it = ASSEMBLER_DIRECTIVES.find(directive_name);
-	if (it == ASSEMBLER_DIRECTIVES.end())
+	if (!has_filename)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_DIRECTIVE, line, line_num);
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, line, line_num);
 		return false;
 	}
 
-	AssemblerDirective dir = it->second;
+	std::string filename(filename_view);
+	std::string file_content;
+
+	// the file is read once here, the second pass only copies the payload
+	auto io_start = std::chrono::steady_clock::now();
+
+	if (!prefetch || !prefetch->binary(filename, file_content))
+	{
+		std::ifstream file(filename, std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+		{
+			errors.addError(ErrorLog::FILE_CANNOT_OPEN, line, line_num);
+			return false;
+		}
+
+		std::streamsize file_size = file.tellg();
+
+		if (file_size < 0)
+		{
+			errors.addError(ErrorLog::FILE_CANNOT_READ, line, line_num);
+			return false;
+		}
+
+		file_content.assign(static_cast<size_t>(file_size), '\0');
+		file.seekg(0, std::ios::beg);
+		file.read(&file_content[0], file_size);
+
+		if (file.gcount() != file_size)
+		{
+			errors.addError(ErrorLog::FILE_CANNOT_READ, line, line_num);
+			return false;
+		}
+	}
+
+	io_wait += std::chrono::duration<double>(std::chrono::steady_clock::now() - io_start).count();
+
+	binary_files.push_back({ filename, content_hash(file_content) });
+
+	size_t data_offset = data_pool.size();
+	packBytes(file_content);
+	addDataStatement(data_offset);
+
+	qprintf(verbose, 2, "Load file: %s, size: %zu bytes, aligned: %zu bytes",
+		filename.c_str(), file_content.size(), (data_pool.size() - data_offset) * 2);
+
+	return true;
+}
+
+bool Assembler::analyzeDirective(std::string_view line, AssemblerDirective dir)
+{
+	qprintf(verbose, 3, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
 	switch (dir)
 	{
@@ -336,22 +924,26 @@ bool Assembler::analyzeDirective(const std::string line)
 	case ASM_INCBIN:
 		return analyzeDirectiveLoadFile(line);
 	default:
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_DIRECTIVE, line, line_num);
+		errors.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_DIRECTIVE, line, line_num);
 		return false;
 	}
 }
 
-bool Assembler::analyzeLabel(const std::string& line)
+bool Assembler::analyzeLabel(std::string_view line, const TokenList& tokens)
 {
-	qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
+	qprintf(verbose, 3, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
-	std::string label_name = line.substr(0, line.length() - 1);
+	std::string_view label_name = tokens[0].text;
+	int label_id = symbols.intern(label_name);
+
+	if (curBlock)
+		image_end += curBlock->size;
 	curBlock = nullptr;
 
-	if (block_by_label.find(label_name) != block_by_label.end())
+	if (block_by_label.get(label_id))
 	{
-		qprintf(verbose, 0, "Found duplicate label %s\n", label_name.c_str());
-		error_log.addError(ErrorLog::ASSEMBLER_MULTIPLE_DEFINITIONS, line, line_num, true);
+		qprintf(verbose, 0, "Found duplicate label %.*s\n", (int)label_name.size(), label_name.data());
+		errors.addError(ErrorLog::ASSEMBLER_MULTIPLE_DEFINITIONS, line, line_num, true);
 		return false;
 	}
 
@@ -370,8 +962,17 @@ bool Assembler::analyzeLabel(const std::string& line)
 		curBlock = &blocks.back();
 	}
 
-	curBlock->label = label_name;
-	block_by_label[label_name] = curBlock;
+	curBlock->label_id = label_id;
+	curBlock->label = symbols.name(label_id);
+	curBlock->image_address = image_end;
+	block_by_label.set(label_id, curBlock);
+
+	Statement st = {};
+	st.kind = STMT_LABEL;
+	st.line = line_num;
+	st.block = curBlock;
+	st.label_ref = -1;
+	statements.push_back(st);
 
 	return true;
 }
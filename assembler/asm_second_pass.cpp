@@ -1,580 +1,159 @@
 #include "assembler.h"
 
-bool Assembler::asm_second_pass(const std::list<std::string>& lines)
-{
-	qprintf(verbose, 2, __func__);
-
-	line_num = 1;
-	bool result = true;
+// Programs below this are encoded on the calling thread, threads cost more than they save
+static const size_t PARALLEL_MIN_STATEMENTS = 16 * 1024;
 
-	for (const auto& line : lines)
-	{
-		if (line.empty()) 
-		{
-			line_num++;
-			continue;
-		}
-		// YandereDev moment
-		if (isLabel(line, false))
-		{
-			if (!processLabel(line))
-				result = false;
-		}
-		else if (isInstruction(line))
-		{
-			if (!processInstruction(line))
-				result = false;
-			
-		}
-		else if (isDirective(line))
-		{
-			if (!processDirective(line))
-				result = false;
-		}
-		else
-		{
-			// I don't know why I put this after first pass
-			error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_TOKEN, line, line_num);
-			result = false;
-		}
-
-		line_num++;
-	}
-
-	return result;
-}
-
-bool Assembler::processNoArgsInstruction(const INSTRUCTION_META& instr)
+bool Assembler::asm_second_pass()
 {
-	switch (instr.opcode_code)
-	{
-	case OPCODE_NOP:
-	case OPCODE_HLT:
-		curBlock->assembled_instructions.push_back(packInstruction(instr.opcode_code, 0, 0, 0));
-		break;
-	default:
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_INSTRUCTION, " Unsupported no-argument instruction ", line_num);
-		return false;
-	}
-
-	return true;
-}
+	qprintf(verbose, 2, __func__);
 
-bool Assembler::processOneArgInstruction(const INSTRUCTION_META& instr, const std::string& arg1)
-{
-	int regnum;
-	if (!isRegister(arg1, regnum))
-	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_REGISTER, arg1, line_num);
+	if (!rom_file && !allocateRom())
 		return false;
-	}
-	
-	switch (instr.opcode_code)
-	{
-	case OPCODE_JPR:
-	case OPCODE_JPC:
-	case OPCODE_JOV:
-	case OPCODE_JZD:
-		curBlock->assembled_instructions.push_back(packInstruction(instr.opcode_code, 0, regnum, 0));
-		break;
-	case OPCODE_LPC:
-		curBlock->assembled_instructions.push_back(packInstruction(instr.opcode_code, regnum, 0, 0));
-		break;
-	default:
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_INSTRUCTION,
-			" Unsupported one-argument instruction ", line_num);
-		return false;
-	}
 
-	return true;
-}
+	// streaming writes share one file buffer, so they stay in order on one thread
+	unsigned threads = rom_file ? 1 : threadCount();
 
-bool Assembler::processTwoArgsInstruction(
-	const INSTRUCTION_META& instr,
-	const std::string& arg1,
-	const std::string& arg2
-) {
-	int 
-		reg1num = 0, 
-		reg2num_or_value = 0,
-		buf = 0;
+	if (threads == 1 || statements.size() < PARALLEL_MIN_STATEMENTS)
+		return encodeStatements(0, statements.size(), errors);
 
-	int 
-		rs = 0, 
-		rt = 0, 
-		rd = 0;
+	// Every block has its final address and its own span of rom, so chunks
+	// starting at labels are independent. A few chunks per thread keep them balanced
+	std::vector<size_t> chunk_starts = { 0 };
+	size_t chunk_size = std::max<size_t>(PARALLEL_MIN_STATEMENTS / 4, statements.size() / (threads * 4));
 
-	if (!isRegister(arg1, reg1num))
-	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_REGISTER, arg1, line_num);
-		return false;
-	}
-
-	bool is_imm = false;
-
-	if (isRegister(arg2, buf))
-	{
-		reg2num_or_value = buf;
-	}
-	else if (isValue16(arg2, buf))
-	{
-		reg2num_or_value = buf;
-		is_imm = true;
-	}
-	else if (isLabel(arg2, true))
-	{
-		auto it = block_by_label.find(arg2);
-		if (it != block_by_label.end())
-		{
-			reg2num_or_value = it->second->base_address;
-			is_imm = true;
-		}
-		else
-		{
-			error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_LABEL, " Undefined label: " + arg2, line_num);
-			return false;
-		}
-	}
-	else
+	for (size_t i = 1; i < statements.size(); i++)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, arg2, line_num);
-		return false;
+		if (statements[i].kind == STMT_LABEL && i - chunk_starts.back() >= chunk_size)
+			chunk_starts.push_back(i);
 	}
+	chunk_starts.push_back(statements.size());
 
-	switch (instr.opcode_code)
-	{
-	case OPCODE_LWI:
-		if (!is_imm)
-		{
-			error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, arg2 + " LWI requires immediate value or label ", line_num);
-			return false;
-		}
-
-		curBlock->assembled_instructions.push_back(packInstruction(instr.opcode_code, reg1num, 0, 0));
-		curBlock->assembled_instructions.push_back(instruction_t(reg2num_or_value));
-
-		return true;
-
-	case OPCODE_TCP:
-	case OPCODE_INC:
-	case OPCODE_DEC:
-	case OPCODE_LWD:
-	case OPCODE_NOT:
-	case OPCODE_MOV:
-	case OPCODE_JRL:
-
-		rd = reg1num;
-		rs = reg2num_or_value;
-
-		break;
+	size_t chunks_num = chunk_starts.size() - 1;
+	qprintf(verbose, 2, "%zu chunks on %u threads", chunks_num, threads);
 
-	case OPCODE_SWD:
+	std::vector<ErrorLog> chunk_errors(chunks_num);
+	std::vector<char> chunk_results(chunks_num);
 
-		rt = reg1num;
-		rs = reg2num_or_value;
-		break;
+	runTasks(chunks_num, threads, [&](size_t i) {
+		// kept per chunk and merged in chunk order, which is line order
+		chunk_results[i] = encodeStatements(chunk_starts[i], chunk_starts[i + 1], chunk_errors[i]);
+	});
 
-	case OPCODE_JGZ:
-	case OPCODE_JLZ:
-	case OPCODE_JEZ:
-	case OPCODE_JNZ:
-
-		rs = reg1num;
-		rt = reg2num_or_value;
-
-		break;
-
-	default:
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_INSTRUCTION,
-			" Unsupported two-argument instruction ", line_num);
-		return false;
-	}
+	bool result = true;
 
-	if (is_imm)
+	for (size_t i = 0; i < chunks_num; i++)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, arg2 +
-			" This instruction requires register as second argument ", line_num);
-		return false;
+		errors.append(chunk_errors[i]);
+		if (!chunk_results[i])
+			result = false;
 	}
 
-	curBlock->assembled_instructions.
-	push_back(
-		packInstruction(instr.opcode_code, rd, rs, rt)
-	);
-
-	return true;
+	return result;
 }
 
-bool Assembler::processThreeArgsInstruction(
-	const INSTRUCTION_META& instr,
-	const std::string& arg1,
-	const std::string& arg2,
-	const std::string& arg3
-)
+// Blocks are checked against total_size before any of them is written into rom
+bool Assembler::allocateRom()
 {
-
-	int rd, rs, rt; // fortunately all 3 rags funcs using only registers
-
-	struct __arg_check__
+	for (const auto& block : blocks)
 	{
-		std::function<bool(const std::string&, int&)> func;
-		const std::string& arg;
-		int& value;
+		int start_pos = block.base_address;
 
-	} checks[] =
-	{
-		{ isRegister, arg1, rd },
-		{ isRegister, arg2, rs },
-		{ isRegister, arg3, rt },
-	};
-
-	
-	for (const auto& x : checks)
-	{
-		if (!x.func(x.arg, x.value))
+		if (block.size > 0 && start_pos + block.size > total_size)
 		{
-			error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, x.arg + " 3-arg instruction requires only registers ", line_num);
+			std::stringstream ss;
+			ss << "Block '" << block.label << "' exceeds total size:" << std::endl
+				<< "  Position: 0x" << std::hex << start_pos << std::endl
+				<< "  Size: 0x" << block.size << std::endl
+				<< "  Total size: 0x" << total_size;
+
+			errors.addError(ErrorLog::ASSEMBLER_INTERNAL_ERROR, ss.str(), -1, true);
 			return false;
 		}
 	}
 
-	switch (instr.opcode_code)
-	{
-	case OPCODE_ADD:
-	case OPCODE_SUB:
-	case OPCODE_ADC:
-	case OPCODE_SBB:
-	case OPCODE_MUL:
-	case OPCODE_DIV:
-	case OPCODE_UML:
-	case OPCODE_UDV:
-	case OPCODE_MHL:
-	case OPCODE_MLH:
-	case OPCODE_MHH:
-	case OPCODE_MLL:
-	case OPCODE_SLL:
-	case OPCODE_SRL:
-	case OPCODE_SRA:
-	case OPCODE_AND:
-	case OPCODE_ORR:
-		curBlock->assembled_instructions.push_back(
-			packInstruction(instr.opcode_code, rd, rs, rt)
-		);
-		break;
-
-	default:
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_INSTRUCTION, " Unsupported three-argument instruction ", line_num);
-		return false;
-	}
-
+	rom.assign(total_size, 0);
 	return true;
 }
 
-
-
-bool Assembler::processInstruction(const std::string& line)
+bool Assembler::encodeStatements(size_t begin, size_t end, ErrorLog& log)
 {
-	qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
-
-	if (line.empty() || line.length() < 3)
-	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_INSTRUCTION, line, line_num);
-		return false;
-	}
-
-	if (line[line.length() - 1] == ',')
-	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_INSTRUCTION, line, line_num);
-		return false;
-	}
-
 	bool result = true;
-	auto tokens = parse_instruction(line);
-
-	if (tokens.empty())
-	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_INSTRUCTION, line, line_num);
-		return false;
-	}
-
-	INSTRUCTION_META meta;
-
-	std::string opcode;
-	std::string args[3];
-
-	opcode = tokens.front();
-	tokens.pop_front();
+	EmitCursor out = { nullptr, 0, &log };
 
-	if (!isOpcode(opcode, meta))
+	for (size_t i = begin; i < end; i++)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_OPCODE, line, line_num);
-		return false;
-	}
-
-	if (meta.opcode_args_num != tokens.size())
-	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGS_NUM, line, line_num);
-		return false;
-	}
-	
-	for (int i = 0; i < meta.opcode_args_num; i++)
-	{
-		args[i] = tokens.front();
-		tokens.pop_front();
-	}
+		const Statement& st = statements[i];
 
-	switch (meta.opcode_args_num)
-	{
-	case 0:
-		qprintf(verbose, 4, "processNoArgsInstruction %s", line.c_str());
-		result = processNoArgsInstruction(meta);
-		break;
-	case 1:
-		qprintf(verbose, 4, "processOneArgInstruction %s", line.c_str());
-		result = processOneArgInstruction(meta, args[0]);
-		break;
-	case 2:
-		qprintf(verbose, 4, "processTwoArgsInstruction %s", line.c_str());
-		result = processTwoArgsInstruction(meta, args[0], args[1]);
-		break;
-	case 3:
-		qprintf(verbose, 4, "processThreeArgsInstruction %s", line.c_str());
-		result = processThreeArgsInstruction(meta, args[0], args[1], args[2]);
-		break;
-	default:
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGS_NUM, line, line_num);
-		return false;
+		switch (st.kind)
+		{
+		case STMT_LABEL:
+			if (rom_file)
+				out.address = st.block->image_address;
+			else
+				out.next = rom.data() + st.block->base_address;
+			break;
+		case STMT_INSTRUCTION:
+			if (!processInstruction(st, out))
+				result = false;
+			break;
+		case STMT_DATA:
+			processData(st, out);
+			break;
+		}
 	}
 
-	/*if (!result) 
-	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, line, line_num);
-	}*/
-
 	return result;
 }
 
-
-
-bool Assembler::processLabel(const std::string& line)
-{
-	qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
-	if (line.empty() || line.length() <= 1) 
-	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_LABEL, line, line_num);
-		return false;
-	}
-
-	std::string labelname = line.substr(0, line.length() - 1);
-
-	auto it = block_by_label.find(labelname);
-
-	if (it == block_by_label.end())
-	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_LABEL, line, line_num);
-		return false;
-	}
-
-	curBlock = it->second;
-
-	return true;
-}
-
-
-bool Assembler::processDirective(const std::string& line)
+bool Assembler::processInstruction(const Statement& st, EmitCursor& out) const
 {
-	qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
-
-	if (line.empty())
+	if (st.opcode != OPCODE_LWI)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_DIRECTIVE, line, line_num);
-		return false;
-	}
-
-	std::stringstream ss(line);
-	std::string directive;
-	ss >> directive;
-
-	if (directive[0] == '.')
-	{
-		directive = directive.substr(1);
-	}
-
-	auto it = ASSEMBLER_DIRECTIVES.find(directive);
-	if (it == ASSEMBLER_DIRECTIVES.end())
-	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_DIRECTIVE, line, line_num);
-		return false;
+		instruction_t word = packInstruction(st.opcode, st.rd, st.rs, st.rt);
+		emit(out, &word, 1);
+		return true;
 	}
 
-	switch (it->second)
-	{
-	case ASM_BYTE:
-		return processDirectiveByte(line);
-	case ASM_DATA16:
-		return processDirectiveData16(line);
-	case ASM_DATA32:
-		return processDirectiveData32(line);
-	case ASM_STRING:
-		return processDirectiveString(line);
-	case ASM_INCBIN:
-		return processDirectiveLoadFile(line);
-	default:
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_DIRECTIVE, line, line_num);
-		return false;
-	}
-}
+	int value = st.imm;
 
-bool Assembler::processDirectiveByte(const std::string& line)
-{
-	auto tokens = parse_directiveData(line);
-	if (tokens.empty())
-	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, line, line_num);
-		return false;
-	}
-	std::vector<byte> bytes;
-
-	for (const auto& token : tokens)
+	if (st.label_ref >= 0)
 	{
-		int value;
-		if (!isValue8(token, value))
+		const Block* block = block_by_label.get(st.label_ref);
+		if (!block)
 		{
-			error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_IMM_VALUE, line, line_num);
+			out.errors->addError(ErrorLog::ASSEMBLER_UNEXCEPTED_LABEL, " Undefined label: " + std::string(symbols.name(st.label_ref)), st.line);
 			return false;
 		}
-		bytes.push_back(static_cast<uint8_t>(value & 0xFF));
-	}
-	for (size_t i = 0; i < bytes.size(); i += 2)
-	{
-		instruction_t packed;
-		if (i + 1 < bytes.size())
-		{
-			packed = (bytes[i + 1] << 8) | bytes[i];
-		}
-		else
-		{
-			packed = bytes[i];
-		}
-		curBlock->assembled_instructions.push_back(packed);
-	}
-
-	qprintf(verbose, 2, "Processed .byte with %zu values (%zu bytes)", tokens.size(), bytes.size());
-	return true;
-}
-
-bool Assembler::processDirectiveData16(const std::string& line)
-{
-	auto tokens = parse_directiveData(line);
 
-	if (tokens.empty())
-	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, line, line_num);
-		return false;
+		value = block->base_address;
 	}
-	for (const auto& token : tokens)
-	{
-		int value;
-		if (!isValue16(token, value))
-		{
-			error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_IMM_VALUE, line, line_num);
-			return false;
-		}
-		curBlock->assembled_instructions.push_back(static_cast<instruction_t>(value & 0xFFFF));
-	}
-
-	qprintf(verbose, 2, "Processed .data16 with %zu values", tokens.size());
-	return true;
-}
 
-bool Assembler::processDirectiveData32(const std::string& line)
-{
-	auto tokens = parse_directiveData(line);
-
-	if (tokens.empty())
-	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, line, line_num);
-		return false;
-	}
-	for (const auto& token : tokens)
-	{
-		int value;
-		if (!isValue32(token, value))
-		{
-			error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_IMM_VALUE, line, line_num);
-			return false;
-		}
-		curBlock->assembled_instructions.push_back(static_cast<instruction_t>(value & 0xFFFF));
-		curBlock->assembled_instructions.push_back(static_cast<instruction_t>((value >> 16) & 0xFFFF));
-	}
+	instruction_t words[2] = { packInstruction(st.opcode, st.rd, 0, 0), instruction_t(value) };
+	emit(out, words, 2);
 
-	qprintf(verbose, 2, "Processed .data32 with %zu values", tokens.size());
 	return true;
 }
 
-bool Assembler::processDirectiveString(const std::string& line)
+void Assembler::processData(const Statement& st, EmitCursor& out) const
 {
-	auto tokens = parse_directiveString(line);
-	if (tokens.empty())
-	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_STRING, line, line_num);
-		return false;
-	}
-
-	std::string str_content = tokens.front();
-
-	std::string full_data = str_content + '\0';
-
-	for (size_t i = 0; i < full_data.size(); i += 2)
+	if (st.data_offset == IN_IMAGE)
 	{
-		uint16_t packed_value;
-		if (i + 1 < full_data.size())
-		{
-			packed_value = (static_cast<uint8_t>(full_data[i + 1]) << 8) |
-				static_cast<uint8_t>(full_data[i]);
-		}
-		else
-		{
-			packed_value = static_cast<uint8_t>(full_data[i]);
-		}
-		curBlock->assembled_instructions.push_back(packed_value);
+		out.address += static_cast<address_t>(st.data_size);
+		return;
 	}
 
-	qprintf(verbose, 2, "Processed .string: \"%s\" (%zu bytes, %zu instructions)",
-		str_content.c_str(), full_data.size(), curBlock->assembled_instructions.size());
-	return true;
+	emit(out, data_pool.data() + st.data_offset, st.data_size);
 }
 
-bool Assembler::processDirectiveLoadFile(const std::string& line)
+void Assembler::emit(EmitCursor& out, const instruction_t* words, size_t count) const
 {
-	auto tokens = parse_directiveLoadFile(line);
-	if (tokens.empty())
+	if (rom_file)
 	{
-		error_log.addError(ErrorLog::ASSEMBLER_UNEXCEPTED_ARGUMENT, line, line_num);
-		return false;
+		rom_file->write(out.address, words, count);
+		out.address += static_cast<address_t>(count);
 	}
-
-	std::string filename = tokens.front();
-	std::string file_content;
-	if (!readFile(filename, file_content, verbose))
+	else
 	{
-		error_log.addError(ErrorLog::FILE_CANNOT_OPEN, line, line_num);
-		return false;
+		out.next = std::copy(words, words + count, out.next);
 	}
-	for (size_t i = 0; i < file_content.size(); i += 2)
-	{
-		uint16_t packed;
-		if (i + 1 < file_content.size())
-		{
-			packed = (static_cast<uint8_t>(file_content[i + 1]) << 8) |
-				static_cast<uint8_t>(file_content[i]);
-		}
-		else
-		{
-			packed = static_cast<uint8_t>(file_content[i]);
-		}
-		curBlock->assembled_instructions.push_back(packed);
-	}
-	qprintf(verbose, 2, "Processed .loadfile: %s (%zu bytes)", filename.c_str(), file_content.size());
-	return true;
-}
\ No newline at end of file
+}
@@ -2,14 +2,20 @@
 #include "utils.h"
 
 Assembler::Assembler()
-	: blocks{}
-	, block_by_label{}
+	: verbose(0)
+	, line_num(0)
+	, blocks{}
+	, prefetch(nullptr)
+	, io_wait(0)
 	, curBlock(nullptr)
 	, has_entry_point(false)
-	, line_num(0)
-	, verbose(0)
 	, ROM_SIZE(0)
 	, total_size(0)
+	, rom_file(nullptr)
+	, image_end(0)
+	, worker_threads(0)
+	, pool(nullptr)
+	, chunk_cache(nullptr)
 {
 
 }
@@ -20,65 +26,90 @@ bool Assembler::is_ok() const
 	return is_okay;
 }
 
+void Assembler::setThreads(unsigned threads)
+{
+	worker_threads = threads;
+}
+
+void Assembler::setPool(WorkPool* pool)
+{
+	this->pool = pool;
+}
+
+void Assembler::setPrefetch(IncludePrefetch* prefetch)
+{
+	this->prefetch = prefetch;
+}
+
+void Assembler::setChunkCache(ChunkCache* cache)
+{
+	chunk_cache = cache;
+}
+
+const std::vector<FileDependency>& Assembler::binaryFiles() const
+{
+	return binary_files;
+}
+
+const ErrorLog& Assembler::diagnostics() const
+{
+	return errors;
+}
+
 void Assembler::clear()
 {
 	verbose = false;
 	line_num = 0;
 
 	blocks.clear();
+	symbols.clear();
 	block_by_label.clear();
 
+	statements.clear();
+	data_pool.clear();
+	binary_files.clear();
+	io_wait = 0;
+	rom.clear();
+
 	curBlock = nullptr;
 	has_entry_point = false;
 
 	ROM_SIZE = 0;
 	total_size = 0;
+
+	rom_file = nullptr;
+	image_end = 0;
+
+	errors.clear();
 	is_okay = true;
 }
 
 void Assembler::clearAssembler()
 {
 	blocks.clear();
+	symbols.clear();
 	block_by_label.clear();
 
+	statements.clear();
+	data_pool.clear();
+	binary_files.clear();
+	io_wait = 0;
+	rom.clear();
+
 	curBlock = nullptr;
 	has_entry_point = false;
 
 	ROM_SIZE = 0;
 	total_size = 0;
+
+	rom_file = nullptr;
+	image_end = 0;
 }
 
+// The second pass wrote every block in place, rom only leaves the assembler
 std::vector<instruction_t> Assembler::assemble_blocks()
 {
-	std::vector<instruction_t> result(total_size, 0);
-
-	for (const auto& block : blocks)
-	{
-		if (block.assembled_instructions.empty())
-			continue;
-
-		int start_pos = block.base_address;
-
-		if (start_pos + block.size > total_size)
-		{
-			std::stringstream ss;
-			ss << "Block '" << block.label << "' exceeds total size:" << std::endl
-				<< "  Position: 0x" << std::hex << start_pos << std::endl
-				<< "  Size: 0x" << block.size << std::endl
-				<< "  Total size: 0x" << total_size;
-
-			error_log.addError(ErrorLog::ASSEMBLER_INTERNAL_ERROR, ss.str(), -1, true);
-			return {};
-		}
-
-		std::copy(
-			block.assembled_instructions.begin(),
-			block.assembled_instructions.end(),
-			result.begin() + start_pos
-		);	
-	}
-
-	return result;
+	return std::move(rom);
 }
 
 std::vector<instruction_t> Assembler::assemble(std::string source_code, int rom_size, bool verbose)
@@ -89,15 +120,56 @@ std::vector<instruction_t> Assembler::assemble(std::string source_code, int rom_
 
 	qprintf(verbose, 1, __func__);
 
-	const std::list<std::string> lines = split_text_to_lines(source_code, true);
+	const SourceText lines(std::move(source_code));
 
 	if (!asm_first_pass(lines))
 		return {};
 
-	if (!asm_second_pass(lines))
+	if (!asm_second_pass())
+		return {};
+
+	return assemble_blocks();
+}
+
+std::vector<instruction_t> Assembler::assemble(LineQueue& input, int rom_size, bool verbose)
+{
+	clear();
+	this->verbose = verbose;
+	ROM_SIZE = rom_size;
+
+	qprintf(verbose, 1, __func__);
+
+	if (!asm_first_pass(input))
+		return {};
+
+	if (!asm_second_pass())
 		return {};
 
 	return assemble_blocks();
 }
 
+bool Assembler::assemble(LineQueue& input, RomFile& output, int rom_size, bool verbose)
+{
+	clear();
+	this->verbose = verbose;
+	ROM_SIZE = rom_size;
+	rom_file = &output;
+
+	qprintf(verbose, 1, "%s - streaming", __func__);
+
+	bool result = asm_first_pass(input) && asm_second_pass();
+
+	if (result)
+	{
+		std::vector<RomRange> layout;
+		for (const auto& block : blocks)
+			layout.push_back({ block.image_address, block.size });
+
+		result = output.finish(layout, errors, verbose);
+	}
+
+	rom_file = nullptr;
+	return result;
+}
+
 
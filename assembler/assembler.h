@@ -2,6 +2,12 @@
 
 #include "common.h"
 #include "utils.h"
+#include "source_text.h"
+#include "line_stream.h"
+#include "rom_file.h"
+#include "symbol_table.h"
+#include "parallel.h"
+#include "include_prefetch.h"
 
 class Assembler
 {
@@ -9,9 +15,38 @@ public:
 
 	std::vector<instruction_t> assemble(std::string source_code, int rom_size, bool verbose = false);
 
+	// Assembles the text of a producer on another thread, lines are analyzed
+	// as they arrive. Returns nothing if the producer closed the queue with an error
+	std::vector<instruction_t> assemble(LineQueue& input, int rom_size, bool verbose = false);
+
+	// Streaming mode - data is encoded straight into the output file as it
+	// is parsed, only code and block sizes stay in memory.
+	// The output file is complete when it returns true
+	bool assemble(LineQueue& input, RomFile& output, int rom_size, bool verbose = false);
+
+	// Files loaded by .include_bin in the last assemble()
+	const std::vector<FileDependency>& binaryFiles() const;
+
+	// Errors of the last assemble(), every instance has its own
+	const ErrorLog& diagnostics() const;
+
 	bool is_ok() const;
 	void clear();
 
+	// Threads for the parallel passes, 0 - one per hardware thread
+	void setThreads(unsigned threads);
+
+	// Runs the parallel passes on a shared pool instead of own threads, nullptr - own threads
+	void setPool(WorkPool* pool);
+
+	// Takes .include_bin files read ahead on I/O threads, nullptr - each is read when reached
+	void setPrefetch(IncludePrefetch* prefetch);
+
+	// First pass chunks analyzed by any assembler sharing the cache, for sources
+	// with text in common. Queue blocks are then analyzed as chunks even on one thread
+	class ChunkCache;
+	void setChunkCache(ChunkCache* cache);
+
 protected:
 
 	bool is_okay;
@@ -22,16 +57,60 @@ protected:
 	struct Block
 	{
 		// for first pass
-		std::string label;
+		int label_id;               // in symbols
+		std::string_view label;     // symbols.name(label_id)
 		int size;
 
-		// for second pass
+		// for second pass - the block is rom[base_address, base_address + size)
 		int base_address;
-		std::vector<instruction_t> assembled_instructions;
+
+		// streaming mode - position in the image, blocks are there in source order
+		int image_address;
 	};
 
 	std::list<Block> blocks;
-	std::map<std::string, Block*> block_by_label;
+
+	// Labels and LWI operands by symbol id
+	SymbolTable symbols;
+	SymbolIndex<Block> block_by_label;
+
+	// Statement IR - the first pass parses every line once into it,
+	// the second pass only resolves labels and encodes
+	enum StatementKind
+	{
+		STMT_LABEL,
+		STMT_INSTRUCTION,
+		STMT_DATA,
+	};
+
+	struct Statement
+	{
+		StatementKind kind;
+		int line;           // source line for diagnostics
+
+		// STMT_LABEL
+		Block* block;
+
+		// STMT_INSTRUCTION
+		int opcode;
+		int rd, rs, rt;
+		int imm;            // LWI immediate
+		int label_ref;      // LWI label, symbol id, -1 - none
+
+		// STMT_DATA - payload words in data_pool,
+		// or IN_IMAGE - already written to rom_file, consecutive lines merged
+		size_t data_offset;
+		size_t data_size;
+	};
+
+	static const size_t IN_IMAGE = SIZE_MAX;
+
+	std::vector<Statement> statements;
+	std::vector<instruction_t> data_pool;
+
+	std::vector<FileDependency> binary_files;
+	IncludePrefetch* prefetch;
+	double io_wait;             // seconds spent waiting for .include_bin files
 
 	Block* curBlock;
 	bool has_entry_point;
@@ -39,6 +118,27 @@ protected:
 	int ROM_SIZE;
 	int total_size;
 
+	// Every block in place, allocated once the first pass has the sizes
+	std::vector<instruction_t> rom;
+
+	// streaming mode
+	RomFile* rom_file;          // nullptr - blocks are assembled in memory
+	address_t image_end;        // image size taken by the finished blocks
+
+	unsigned worker_threads;
+	WorkPool* pool;
+	ChunkCache* chunk_cache;
+
+	ErrorLog errors;
+
+	// Where the second pass writes, one per worker
+	struct EmitCursor
+	{
+		instruction_t* next;    // next word in rom
+		address_t address;      // streaming mode - image address of the next word instead
+		ErrorLog* errors;       // the worker's own log
+	};
+
 protected:
 
 	void clearPreprocess();
@@ -47,44 +147,68 @@ protected:
 	std::vector<instruction_t> assemble_blocks();
 
 	// for first pass
-	bool asm_first_pass(const std::list<std::string>& lines);
+	bool asm_first_pass(const SourceText& lines);
+	bool asm_first_pass(LineQueue& input);
+	bool analyzeLine(std::string_view line);
+	bool layoutBlocks(bool result);
+	bool checkOverlaps();
+
+	// Parallel first pass - chunks of lines are analyzed on their own by
+	// workers, then merged in source order
+	struct ChunkAnalysis
+	{
+		std::unique_ptr<Assembler> part;    // what the lines declare and emit, and their errors
+		Block inherited{};                  // stands in for the block open when the chunk starts
+		size_t orphan_lines = 0;            // lines that went into `inherited`
+		bool result = true;
+	};
 
-	bool analyzeInstruction(const std::string& line);
-	bool analyzeLabel(const std::string& line);
-	bool analyzeDirective(const std::string line);
-	bool analyzeDirectiveString(const std::string line);
-	bool analyzeDirectiveByte(const std::string line);
-	bool analyzeDirectiveData16(const std::string line);
-	bool analyzeDirectiveData32(const std::string line);
+	struct FirstPassChunk
+	{
+		SourceText owned;                   // text of a queue block
+		const SourceText* text;
+		size_t begin, end;                  // lines of text
+		int first_line;
 
-	bool analyzeDirectiveLoadFile(const std::string line);
+		std::shared_ptr<const ChunkAnalysis> analysis;  // may be shared through a ChunkCache
+	};
 
-	// for second pass
-	bool asm_second_pass(const std::list<std::string>& lines);
-
-	bool processInstruction(const std::string& line);
-	bool processNoArgsInstruction(const INSTRUCTION_META& instr);
-	bool processOneArgInstruction(const INSTRUCTION_META& instr, const std::string& arg1);
-	bool processTwoArgsInstruction(
-		const INSTRUCTION_META& instr,
-		const std::string& arg1,
-		const std::string& arg2s
-	);
-	bool processThreeArgsInstruction(
-		const INSTRUCTION_META& instr,
-		const std::string& arg1,
-		const std::string& arg2,
-		const std::string& arg3
+	unsigned threadCount() const;
+	void runTasks(size_t count, unsigned threads, const std::function<void(size_t)>& task);
+	bool analyzeChunks(std::vector<FirstPassChunk>& chunks, unsigned threads);
+	std::shared_ptr<const ChunkAnalysis> analyzeChunk(const FirstPassChunk& chunk) const;
+	bool mergeChunk(const FirstPassChunk& chunk);
+
+	bool analyzeInstruction(std::string_view line, const TokenList& tokens);
+	bool analyzeNoArgsInstruction(Statement& st);
+	bool analyzeOneArgInstruction(Statement& st, const Token& arg1);
+	bool analyzeTwoArgsInstruction(Statement& st, const Token& arg1, const Token& arg2);
+	bool analyzeThreeArgsInstruction(
+		Statement& st,
+		const Token& arg1,
+		const Token& arg2,
+		const Token& arg3
 	);
 
-	bool processLabel(const std::string& line);
+	bool analyzeLabel(std::string_view line, const TokenList& tokens);
+	bool analyzeDirective(std::string_view line, AssemblerDirective dir);
+	bool analyzeDirectiveString(std::string_view line);
+	bool analyzeDirectiveByte(std::string_view line);
+	bool analyzeDirectiveData16(std::string_view line);
+	bool analyzeDirectiveData32(std::string_view line);
+	bool analyzeDirectiveLoadFile(std::string_view line);
+
+	void addDataStatement(size_t data_offset);
+	void packBytes(std::string_view bytes);
 
-	bool processDirective(const std::string& line);
-	bool processDirectiveByte(const std::string& line);
-	bool processDirectiveData16(const std::string& line);
-	bool processDirectiveData32(const std::string& line);
-	bool processDirectiveString(const std::string& line);
-	bool processDirectiveLoadFile(const std::string& line);
+	// for second pass
+	bool asm_second_pass();
+
+	bool allocateRom();
+	bool encodeStatements(size_t begin, size_t end, ErrorLog& log);
+	bool processInstruction(const Statement& st, EmitCursor& out) const;
+	void processData(const Statement& st, EmitCursor& out) const;
+	void emit(EmitCursor& out, const instruction_t* words, size_t count) const;
 
 public:
 
@@ -92,4 +216,36 @@ public:
 
 	virtual ~Assembler() = default;
 
-};
\ No newline at end of file
+};
+
+// A chunk analyzes the same in every assembler when it has the same text,
+// first line and rom size. One asked for while another assembler is still
+// analyzing it waits for that analysis instead of repeating it
+class Assembler::ChunkCache
+{
+public:
+
+	using Analysis = std::shared_ptr<const ChunkAnalysis>;
+
+	ChunkCache();
+
+	Analysis get(const std::string& text, int first_line, int rom_size, const std::function<Analysis()>& analyze);
+
+	size_t hits() const;
+	size_t misses() const;
+
+private:
+
+	struct Entry
+	{
+		std::string text;
+		int first_line;
+		int rom_size;
+		std::shared_future<Analysis> analysis;
+	};
+
+	mutable std::mutex mutex;
+	std::unordered_multimap<uint64_t, Entry> entries;   // by content_hash of the text
+	size_t hit_count;
+	size_t miss_count;
+};
@@ -0,0 +1,159 @@
+#include "build_cache.h"
+#include "utils.h"
+
+// bump when the output of the same input can change
+static const char BUILD_CACHE_VERSION[] = "asm build cache 1";
+
+static bool fileMatches(const FileDependency& dep)
+{
+    uint64_t hash;
+    return file_content_hash(dep.path, hash) && hash == dep.hash;
+}
+
+BuildCache::BuildCache()
+    : verbose(false)
+    , verilog(false)
+    , rom_size(0)
+    , manifest_key(0)
+{
+}
+
+void BuildCache::setDir(const std::string& dir)
+{
+    this->dir = dir;
+}
+
+bool BuildCache::enabled() const
+{
+    return !dir.empty();
+}
+
+std::string BuildCache::entryPath(uint64_t key, const char* extension) const
+{
+    std::string name = qsprintf("%016llx.%s", static_cast<unsigned long long>(key), extension);
+    return (std::filesystem::path(dir) / name).string();
+}
+
+void BuildCache::begin(uint64_t source_hash, int rom_size, bool verilog, bool verbose)
+{
+    this->verbose = verbose;
+    this->verilog = verilog;
+    this->rom_size = rom_size;
+
+    // relative #include and .include_bin paths resolve against
+    // the working directory, so it is part of the key
+    std::error_code ec;
+    std::string cwd = std::filesystem::current_path(ec).string();
+
+    std::string header = qsprintf("%s\n%s\n%d\n%d\n%016llx\n", BUILD_CACHE_VERSION, cwd.c_str(), rom_size, verilog ? 1 : 0,
+        static_cast<unsigned long long>(source_hash));
+    manifest_key = content_hash(header);
+}
+
+bool BuildCache::fetch(const std::string& output_file)
+{
+    std::ifstream manifest(entryPath(manifest_key, "manifest"));
+
+    auto miss = [&](const char* reason) {
+        qprintf(verbose, 2, "BUILD CACHE MISS: %s", reason);
+        countRun(false);
+        return false;
+    };
+
+    if (!manifest.is_open())
+        return miss("no manifest");
+
+    // manifest: "<object key>" then "<hash> <path>" per dependency
+    unsigned long long object_key = 0;
+    std::string line;
+
+    if (!std::getline(manifest, line) || sscanf(line.c_str(), "%llx", &object_key) != 1)
+        return miss("damaged manifest");
+
+    while (std::getline(manifest, line))
+    {
+        unsigned long long hash = 0;
+        size_t space = line.find(' ');
+
+        if (space == std::string::npos || sscanf(line.c_str(), "%llx", &hash) != 1)
+            return miss("damaged manifest");
+
+        if (!fileMatches({ line.substr(space + 1), hash }))
+            return miss("dependency changed");
+    }
+
+    std::error_code ec;
+    std::filesystem::copy_file(entryPath(object_key, "rom"), output_file,
+        std::filesystem::copy_options::overwrite_existing, ec);
+
+    if (ec)
+        return miss("no object");
+
+    qprintf(verbose, 2, "BUILD CACHE HIT: %016llx", object_key);
+    countRun(true);
+    return true;
+}
+
+void BuildCache::store(
+    const std::string& output_file,
+    uint64_t preprocessed_hash,
+    const std::vector<FileDependency>& includes,
+    const std::vector<FileDependency>& binaries
+)
+{
+    std::string key_data = qsprintf("%s\n%016llx\n%d\n%d\n", BUILD_CACHE_VERSION,
+        static_cast<unsigned long long>(preprocessed_hash), rom_size, verilog ? 1 : 0);
+
+    for (const auto& dep : binaries)
+        key_data += qsprintf("%016llx\n", static_cast<unsigned long long>(dep.hash));
+
+    uint64_t object_key = content_hash(key_data);
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+
+    // copied aside and renamed, like writeFileAtomic() - the output can be too big to read whole
+    std::string object_path = entryPath(object_key, "rom");
+    if (!std::filesystem::exists(object_path, ec))
+    {
+        std::string tmp_path = tempFileName(object_path);
+
+        std::filesystem::copy_file(output_file, tmp_path, ec);
+        if (!ec)
+            std::filesystem::rename(tmp_path, object_path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(tmp_path, ec);
+            return;
+        }
+    }
+
+    std::string manifest = qsprintf("%016llx\n", static_cast<unsigned long long>(object_key));
+
+    for (const auto* list : { &includes, &binaries })
+        for (const auto& dep : *list)
+            manifest += qsprintf("%016llx ", static_cast<unsigned long long>(dep.hash)) + dep.path + "\n";
+
+    if (writeFileAtomic(entryPath(manifest_key, "manifest"), manifest))
+        qprintf(verbose, 2, "BUILD CACHE STORED: %016llx", static_cast<unsigned long long>(object_key));
+}
+
+void BuildCache::countRun(bool hit)
+{
+    std::string stats_path = (std::filesystem::path(dir) / "stats").string();
+
+    unsigned long long hits = 0, misses = 0;
+    std::string data;
+
+    if (readWholeFile(stats_path, data))
+        sscanf(data.c_str(), "hits %llu misses %llu", &hits, &misses);
+
+    (hit ? hits : misses)++;
+
+    // concurrent runs may lose a count, the counters are only for reporting
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    writeFileAtomic(stats_path, qsprintf("hits %llu misses %llu\n", hits, misses));
+
+    qprintf(verbose, 1, "BUILD CACHE: %s, %llu hits, %llu misses in total", hit ? "hit" : "miss", hits, misses);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "common.h"
+
+/*
+	Whole-build cache.
+
+	A build is looked up by its manifest key - the main source, the defines,
+	the options and the working directory. The manifest lists every file the build read
+	with its content hash and names the output object. The object itself is
+	keyed by the preprocessed source, the .include_bin contents and the
+	options, so sources that preprocess the same share one object.
+
+	Layout of the cache directory:
+		<key>.manifest   - file dependencies and the object key
+		<key>.rom        - output file as written by writeFile()
+		stats            - hit and miss counters of all runs
+*/
+class BuildCache
+{
+public:
+
+	BuildCache();
+
+	// Cache directory, empty disables the cache
+	void setDir(const std::string& dir);
+	bool enabled() const;
+
+	// Computes the manifest key, source_hash is content_hash of the unpreprocessed
+	// main file with the -D defines hashed in
+	void begin(uint64_t source_hash, int rom_size, bool verilog, bool verbose);
+
+	// Copies the output of an earlier build with the same inputs,
+	// false - the build has to run
+	bool fetch(const std::string& output_file);
+
+	// Saves a finished build, preprocessed_hash is content_hash of the preprocessor output
+	void store(
+		const std::string& output_file,
+		uint64_t preprocessed_hash,
+		const std::vector<FileDependency>& includes,
+		const std::vector<FileDependency>& binaries
+	);
+
+private:
+
+	std::string entryPath(uint64_t key, const char* extension) const;
+	void countRun(bool hit);
+
+	std::string dir;
+	bool verbose;
+	bool verilog;
+	int rom_size;
+	uint64_t manifest_key;
+};
@@ -8,15 +8,28 @@
 
 #include <cstdint>
 #include <cstdarg>
+#include <cstring>
+#include <charconv>
 
 #include <vector>
 #include <list>
 #include <stack>
 #include <string>
+#include <string_view>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
 #include <functional>
+#include <filesystem>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <future>
 
-#include <regex>
 #include <set>
 
 #include <algorithm>
@@ -52,30 +65,25 @@ struct INSTRUCTION_META
 	int opcode_code;
 };
 
+// File read during a build and the content_hash of what was read
+struct FileDependency
+{
+	std::string path;
+	uint64_t hash;
+};
+
 const std::string ENTRY_POINT = "START"; // No entry point - No assemble 
 
+#include "perfect_hash.h"
 #include "opcodes.h"
 
 // 3 bits per register - 8 registers
 // R0 is not zero register
 // Do with registers all that you want
 
-// I could use some like:
-// "R" + i
-// string r = "R0"; r[1] += i;
-// but I fuck it
-
-const std::map<std::string, int> REGISTERS
-{
-	{ "R0", 0 },
-	{ "R1", 1 },
-	{ "R2", 2 },
-	{ "R3", 3 },
-	{ "R4", 4 },
-	{ "R5", 5 },
-	{ "R6", 6 },
-	{ "R7", 7 }
-};
+// Registers are named "R" + i,
+// isRegister() decodes the number straight from the name
+constexpr int REGISTERS_COUNT = 8;
 
 // directives
 
@@ -14,11 +14,12 @@ enum PreprocessorDirective
 	PREP_ENDIF,
 	PREP_MACRO,
 	PREP_ENDMACRO,
+	PREP_ONCE,
 
 	PREPROCESSOR_DIRECTIVES_COUNT
 };
 
-const std::map<std::string, PreprocessorDirective> PREPROCESSOR_DIRECTIVES = {
+inline constexpr auto PREPROCESSOR_DIRECTIVES = make_perfect_hash<PreprocessorDirective, 4, 0x811c9e56u>({
 	{"include" , PREP_INCLUDE },
 	{"define"  , PREP_DEFINE  },
 	{"else"    , PREP_ELSE    },
@@ -29,7 +30,10 @@ const std::map<std::string, PreprocessorDirective> PREPROCESSOR_DIRECTIVES = {
 	{"endif"   , PREP_ENDIF   },
 	{"macro"   , PREP_MACRO   },
 	{"endmacro", PREP_ENDMACRO},
-};
+	{"once"    , PREP_ONCE    },
+});
+
+static_assert(PREPROCESSOR_DIRECTIVES.is_perfect(), "PREPROCESSOR_DIRECTIVES hash collision - pick another seed");
 
 enum AssemblerDirective
 {
@@ -44,11 +48,12 @@ enum AssemblerDirective
 
 
 
-const std::map<std::string, AssemblerDirective> ASSEMBLER_DIRECTIVES =
-{
+inline constexpr auto ASSEMBLER_DIRECTIVES = make_perfect_hash<AssemblerDirective, 3, 0x811c9dc9u>({
 	{"byte"       , ASM_BYTE  },
 	{"data16"     , ASM_DATA16},
 	{"data32"     , ASM_DATA32},
 	{"string"     , ASM_STRING},
 	{"include_bin", ASM_INCBIN},
-};
\ No newline at end of file
+});
+
+static_assert(ASSEMBLER_DIRECTIVES.is_perfect(), "ASSEMBLER_DIRECTIVES hash collision - pick another seed");
\ No newline at end of file
@@ -1,8 +1,6 @@
 #include "error.h"
 #include "common.h"
 
-ErrorLog error_log;
-
 std::string ErrorLog::getErrors() const
 {
 	std::list<Error> crit_errs{};
@@ -56,9 +54,9 @@ std::string ErrorLog::getErrors() const
 }
 
 
-void ErrorLog::addError(ErrorType type, std::string contents, int line, bool critical)
+void ErrorLog::addError(ErrorType type, std::string_view contents, int line, bool critical)
 {
-	Error err = { type, contents, line, critical };
+	Error err = { type, std::string(contents), line, critical };
 	errors.push_back(err);
 }
 
@@ -67,6 +65,11 @@ bool ErrorLog::has_errors() const
 	return !errors.empty();
 }
 
+void ErrorLog::append(const ErrorLog& other)
+{
+	errors.insert(errors.end(), other.errors.begin(), other.errors.end());
+}
+
 std::string ErrorLog::getStrByErrorType(ErrorType t) const
 {
     static const std::map<ErrorType, std::string> error_messages =
@@ -86,6 +89,9 @@ std::string ErrorLog::getStrByErrorType(ErrorType t) const
         { FILE_CANNOT_READ, "Cannot read file"                   },
         { FILE_CANNOT_WRITE, "Cannot write file"                 },
 
+        { SOCKET_CANNOT_LISTEN, "Cannot listen on socket"        },
+        { SOCKET_CANNOT_CONNECT, "Cannot connect to server"      },
+
         { ASSEMBLER_MULTIPLE_DEFINITIONS, "Multiple definitions" },
         { ASSEMBLER_MULTIPLE_UNEXCEPTED_ARGS, "Multiple unexcepted arguments" },
 
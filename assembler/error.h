@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <list>
 
 class ErrorLog
@@ -9,9 +10,11 @@ public:
 	enum ErrorType;
 
 	std::string getErrors() const;
-	void addError(ErrorType type, std::string contents, int line, bool critical = false);
+	void addError(ErrorType type, std::string_view contents, int line, bool critical = false);
 	std::string getStrByErrorType(ErrorType t) const;
 	bool has_errors() const;
+	// Adds the errors of another log after the own ones
+	void append(const ErrorLog& other);
 
     void clear();
 
@@ -57,6 +60,9 @@ public:
         FILE_CANNOT_OPEN,
         FILE_CANNOT_READ,
         FILE_CANNOT_WRITE,
+
+        SOCKET_CANNOT_LISTEN,
+        SOCKET_CANNOT_CONNECT,
     };
 
 
@@ -77,5 +83,3 @@ public:
     virtual ~ErrorLog() = default;
 
 };
-
-extern ErrorLog error_log;
\ No newline at end of file
@@ -0,0 +1,178 @@
+#include "include_prefetch.h"
+#include "utils.h"
+
+IncludePrefetch::IncludePrefetch(unsigned threads)
+    : max_threads(std::max(1u, threads))
+    , read_ahead(0)
+    , stopping(false)
+{
+}
+
+IncludePrefetch::~IncludePrefetch()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queued.notify_all();
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+// Text and binary reads of one name are separate entries
+std::string IncludePrefetch::entryKey(std::string_view filename, bool binary)
+{
+    std::string key(binary ? "b:" : "t:");
+    key.append(filename);
+    return key;
+}
+
+void IncludePrefetch::scan(const SourceText& lines)
+{
+    for (std::string_view line : lines)
+    {
+        PreprocessorDirective type;
+        std::string_view filename;
+
+        if (peekPreprocessDirective(line, type) && type == PREP_INCLUDE)
+        {
+            std::string include = parse_include(line);
+            if (!include.empty())
+                request(include, false);
+        }
+        else if (!line.empty() && line[0] == '.' && parse_directiveLoadFile(line, filename))
+        {
+            request(filename, true);
+        }
+    }
+}
+
+void IncludePrefetch::request(std::string_view filename, bool binary)
+{
+    std::string key = entryKey(filename, binary);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (stopping || entries.count(key))
+            return;
+
+        Entry& entry = entries[key];
+        entry.binary = binary;
+        entry.state = ENTRY_QUEUED;
+        queue.push_back(key);
+
+        if (threads.size() < max_threads && threads.size() < queue.size())
+            threads.emplace_back(&IncludePrefetch::workerLoop, this);
+    }
+
+    queued.notify_one();
+}
+
+// The entry once it is read - by the caller if it was still queued.
+// nullptr - never requested
+IncludePrefetch::Entry* IncludePrefetch::claim(const std::string& key, std::unique_lock<std::mutex>& lock)
+{
+    auto it = entries.find(key);
+    if (it == entries.end())
+        return nullptr;
+
+    if (it->second.state == ENTRY_QUEUED)
+        read(key, false, lock);
+
+    finished.wait(lock, [&] { return it->second.state != ENTRY_READING; });
+    return &it->second;
+}
+
+bool IncludePrefetch::source(const std::string& filename, std::filesystem::file_time_type mtime, std::shared_ptr<const SourceText>& lines)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    Entry* entry = claim(entryKey(filename, false), lock);
+    if (!entry || entry->state != ENTRY_DONE || entry->mtime != mtime)
+        return false;
+
+    lines = entry->lines;
+    return true;
+}
+
+bool IncludePrefetch::binary(const std::string& filename, std::string& data)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    Entry* entry = claim(entryKey(filename, true), lock);
+    if (!entry || entry->state != ENTRY_DONE)
+        return false;
+
+    data = std::move(entry->data);
+    entry->state = ENTRY_TAKEN;
+    return true;
+}
+
+size_t IncludePrefetch::prefetched() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return read_ahead;
+}
+
+// Reads a queued entry with the lock released. Text files are split into
+// lines here and scanned for the files they name in turn.
+// ahead - an I/O thread got to it before anyone asked
+void IncludePrefetch::read(const std::string& key, bool ahead, std::unique_lock<std::mutex>& lock)
+{
+    Entry& entry = entries[key];    // nodes stay put while others are added
+    entry.state = ENTRY_READING;
+
+    std::string filename = key.substr(2);
+    bool binary = entry.binary;
+
+    lock.unlock();
+
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(filename, ec);
+
+    std::string data;
+    ErrorLog ignored;       // the consumer reads it again and reports why it fails
+    bool ok = readFile(filename, data, ignored, false);
+
+    std::shared_ptr<const SourceText> lines;
+    if (ok && !binary)
+    {
+        auto text = std::make_shared<SourceText>(std::move(data));
+        scan(*text);
+        lines = std::move(text);
+    }
+
+    lock.lock();
+
+    entry.mtime = mtime;
+    entry.lines = std::move(lines);
+    if (binary)
+        entry.data = std::move(data);
+    entry.state = ok ? ENTRY_DONE : ENTRY_FAILED;
+
+    if (ok && ahead)
+        read_ahead++;
+
+    finished.notify_all();
+}
+
+void IncludePrefetch::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true)
+    {
+        queued.wait(lock, [&] { return stopping || !queue.empty(); });
+        if (stopping)
+            return;
+
+        std::string key = std::move(queue.front());
+        queue.pop_front();
+
+        // a consumer may have read it meanwhile
+        if (entries[key].state == ENTRY_QUEUED)
+            read(key, true, lock);
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "common.h"
+#include "source_text.h"
+
+/*
+	Include prefetching.
+
+	The files named by #include and .include_bin lines are read on I/O
+	threads before the preprocessor and the assembler reach those lines.
+	Every text file read is scanned the same way, so a whole include tree
+	is in flight at once, and a name is read once however often it shows
+	up. Lines of inactive branches are scanned too - a file that is never
+	used costs a read off the critical path, nothing more.
+
+	A consumer asking for a file being read waits for it; one still in the
+	queue is read by the consumer itself rather than after everything
+	queued before it. Consumers time these waits, which is the I/O left on
+	their critical path.
+*/
+
+class IncludePrefetch
+{
+public:
+
+	explicit IncludePrefetch(unsigned threads = DEFAULT_THREADS);
+	~IncludePrefetch();
+
+	IncludePrefetch(const IncludePrefetch&) = delete;
+	IncludePrefetch& operator=(const IncludePrefetch&) = delete;
+
+	// Queues the files the lines name, the I/O threads start on the first one
+	void scan(const SourceText& lines);
+
+	// Lines of an #include file read at mtime, false - never queued, unreadable
+	// or changed since, the caller reads it
+	bool source(const std::string& filename, std::filesystem::file_time_type mtime, std::shared_ptr<const SourceText>& lines);
+
+	// Contents of an .include_bin file, handed out once, false - the caller reads it
+	bool binary(const std::string& filename, std::string& data);
+
+	// Files read ahead of their use so far
+	size_t prefetched() const;
+
+private:
+
+	static const unsigned DEFAULT_THREADS = 4;
+
+	enum EntryState
+	{
+		ENTRY_QUEUED,
+		ENTRY_READING,
+		ENTRY_DONE,
+		ENTRY_FAILED,
+		ENTRY_TAKEN,        // binary data handed out
+	};
+
+	struct Entry
+	{
+		bool binary;
+		EntryState state;
+		std::filesystem::file_time_type mtime;
+		std::shared_ptr<const SourceText> lines;
+		std::string data;
+	};
+
+	static std::string entryKey(std::string_view filename, bool binary);
+
+	void request(std::string_view filename, bool binary);
+	Entry* claim(const std::string& key, std::unique_lock<std::mutex>& lock);
+	void read(const std::string& key, bool ahead, std::unique_lock<std::mutex>& lock);
+	void workerLoop();
+
+	mutable std::mutex mutex;
+	std::condition_variable queued;     // queue not empty or stopping
+	std::condition_variable finished;   // an entry left ENTRY_READING
+
+	std::unordered_map<std::string, Entry> entries;     // by entryKey()
+	std::deque<std::string> queue;
+	std::vector<std::thread> threads;
+	unsigned max_threads;
+	size_t read_ahead;
+	bool stopping;
+};
@@ -0,0 +1,222 @@
+#include "lexer.h"
+#include "utils.h"
+
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+}
+
+static bool isSeparator(char c)
+{
+    return isSpace(c) || c == ',' || c == ':' || c == '"' || c == '\'';
+}
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static TokenKind classifyWord(std::string_view word, int& value)
+{
+    value = 0;
+
+    char first = word[0];
+
+    if (first == '#')
+        return word.size() > 1 ? TOKEN_PREPROCESSOR : TOKEN_UNKNOWN;
+
+    if (first == '.')
+        return word.size() > 1 ? TOKEN_DIRECTIVE : TOKEN_UNKNOWN;
+
+    if (isDigit(first) || ((first == '-' || first == '+') && word.size() > 1 && isDigit(word[1])))
+        return TOKEN_NUMBER;
+
+    if (!isValidIdentifier(word))
+        return TOKEN_UNKNOWN;
+
+    if (isRegister(word, value))
+        return TOKEN_REGISTER;
+
+    INSTRUCTION_META meta;
+    if (isOpcode(word, meta))
+    {
+        value = meta.opcode_code;
+        return TOKEN_OPCODE;
+    }
+
+    return TOKEN_IDENTIFIER;
+}
+
+Lexer::Lexer(std::string_view line)
+    : line(line)
+    , pos(0)
+{
+}
+
+void Lexer::skipSpaces()
+{
+    while (pos < line.size() && isSpace(line[pos]))
+        pos++;
+
+    // comment swallows the rest of the line
+    if (pos + 1 < line.size() && line[pos] == '/' && line[pos + 1] == '/')
+        pos = line.size();
+}
+
+std::string_view Lexer::rest()
+{
+    skipSpaces();
+    return line.substr(pos);
+}
+
+bool Lexer::next(Token& token)
+{
+    skipSpaces();
+
+    token = { TOKEN_NONE, {}, 0 };
+
+    if (pos >= line.size())
+        return false;
+
+    size_t start = pos;
+    char c = line[pos];
+
+    switch (c)
+    {
+    case ',':
+        pos++;
+        token.kind = TOKEN_COMMA;
+        break;
+
+    case ':':
+        pos++;
+        token.kind = TOKEN_COLON;
+        break;
+
+    case '"':
+    case '\'':
+    {
+        size_t end = line.find(c, pos + 1);
+        if (end == std::string_view::npos)
+        {
+            // unterminated literal - take the rest of the line
+            pos = line.size();
+            token.kind = TOKEN_UNKNOWN;
+        }
+        else
+        {
+            pos = end + 1;
+            token.kind = c == '"' ? TOKEN_STRING : TOKEN_NUMBER;
+        }
+        break;
+    }
+
+    default:
+        while (pos < line.size() && !isSeparator(line[pos]))
+        {
+            if (line[pos] == '/' && pos + 1 < line.size() && line[pos + 1] == '/')
+                break;
+            pos++;
+        }
+        token.text = line.substr(start, pos - start);
+        token.kind = classifyWord(token.text, token.value);
+        return true;
+    }
+
+    token.text = line.substr(start, pos - start);
+    return true;
+}
+
+// Collects the tokens up to the next comma into one operand
+template <class Source>
+static bool readOperand(Source& source, Token& operand)
+{
+    Token tok;
+    int tokens_num = 0;
+    const char* end = nullptr;
+
+    operand = { TOKEN_NONE, {}, 0 };
+
+    if (!source.next(tok))
+        return false;
+
+    do
+    {
+        if (tok.kind == TOKEN_COMMA)
+            break;
+
+        if (!tokens_num)
+            operand = tok;
+
+        end = tok.text.data() + tok.text.size();
+        tokens_num++;
+    } while (source.next(tok));
+
+    if (tokens_num > 1)
+    {
+        operand.kind = TOKEN_UNKNOWN;
+        operand.value = 0;
+        operand.text = std::string_view(operand.text.data(), end - operand.text.data());
+    }
+
+    return true;
+}
+
+bool Lexer::nextOperand(Token& operand)
+{
+    return readOperand(*this, operand);
+}
+
+TokenReader::TokenReader(const TokenList& tokens, int first)
+    : tokens(tokens)
+    , pos(first)
+{
+}
+
+bool TokenReader::next(Token& token)
+{
+    if (pos >= tokens.count)
+        return false;
+
+    token = tokens[pos++];
+    return true;
+}
+
+bool TokenReader::nextOperand(Token& operand)
+{
+    return readOperand(*this, operand);
+}
+
+int tokenize(std::string_view line, TokenList& tokens)
+{
+    Lexer lexer(line);
+    Token tok;
+
+    tokens.count = 0;
+    tokens.truncated = false;
+
+    while (lexer.next(tok))
+    {
+        if (tokens.count == MAX_LINE_TOKENS)
+        {
+            tokens.truncated = true;
+            break;
+        }
+        tokens.tokens[tokens.count++] = tok;
+    }
+
+    return tokens.count;
+}
+
+bool isLabelDeclaration(const TokenList& tokens)
+{
+    if (tokens.count != 2 || tokens.kind(1) != TOKEN_COLON)
+        return false;
+
+    // no space allowed before the colon
+    if (tokens[0].text.data() + tokens[0].text.size() != tokens[1].text.data())
+        return false;
+
+    TokenKind kind = tokens.kind(0);
+    return kind == TOKEN_IDENTIFIER || kind == TOKEN_OPCODE || kind == TOKEN_REGISTER;
+}
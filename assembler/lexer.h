@@ -0,0 +1,91 @@
+#pragma once
+
+#include "common.h"
+
+/*
+	Single pass line lexer.
+
+	Tokens are views into the scanned line, nothing is copied,
+	so the line must outlive every token produced from it.
+*/
+
+enum TokenKind
+{
+	TOKEN_NONE = 0,     // empty operand / end of line
+	TOKEN_OPCODE,       // NOP, LWI, ADD ...
+	TOKEN_REGISTER,     // R0 .. R7
+	TOKEN_NUMBER,       // 12, -5, 0x1F, 'A'
+	TOKEN_IDENTIFIER,   // label, macro or define name
+	TOKEN_DIRECTIVE,    // .byte, .string ...
+	TOKEN_PREPROCESSOR, // #include, #define ...
+	TOKEN_STRING,       // "text"
+	TOKEN_COMMA,
+	TOKEN_COLON,
+	TOKEN_UNKNOWN,
+};
+
+struct Token
+{
+	TokenKind kind;
+	std::string_view text;
+	int value;          // register number or opcode code, 0 otherwise
+};
+
+constexpr int MAX_LINE_TOKENS = 16;
+
+// Head of a line - enough to classify it and to parse any instruction
+struct TokenList
+{
+	Token tokens[MAX_LINE_TOKENS];
+	int count;
+	bool truncated;     // line has more than MAX_LINE_TOKENS tokens
+
+	const Token& operator[](int i) const { return tokens[i]; }
+	bool empty() const { return count == 0; }
+	TokenKind kind(int i) const { return i < count ? tokens[i].kind : TOKEN_NONE; }
+};
+
+class Lexer
+{
+public:
+
+	explicit Lexer(std::string_view line);
+
+	bool next(Token& token);
+
+	// Next comma separated operand. The token text spans the whole operand;
+	// an operand made of several tokens has TOKEN_UNKNOWN kind,
+	// an empty one (",,") has TOKEN_NONE kind.
+	bool nextOperand(Token& operand);
+
+	// Unscanned tail of the line, leading whitespace skipped
+	std::string_view rest();
+
+private:
+
+	void skipSpaces();
+
+	std::string_view line;
+	size_t pos;
+};
+
+// Walks an already tokenized line the same way Lexer walks the text
+class TokenReader
+{
+public:
+
+	TokenReader(const TokenList& tokens, int first = 0);
+
+	bool next(Token& token);
+	bool nextOperand(Token& operand);
+
+private:
+
+	const TokenList& tokens;
+	int pos;
+};
+
+int tokenize(std::string_view line, TokenList& tokens);
+
+// label declaration - "name:"
+bool isLabelDeclaration(const TokenList& tokens);
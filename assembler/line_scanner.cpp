@@ -0,0 +1,290 @@
+#include "line_scanner.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define LINE_SCANNER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(LINE_SCANNER_X86) && !defined(_MSC_VER)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static int lowestBit(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// State machine fed with the positions of '\n', '/', '"' and '\'' only
+class LineEmitter
+{
+public:
+
+    LineEmitter(std::string_view text, bool trim_lines, bool del_comms, std::vector<LineSpan>& spans)
+        : data(text.data())
+        , size(text.size())
+        , trim_lines(trim_lines)
+        , del_comms(del_comms)
+        , spans(spans)
+        , line_start(0)
+        , comment(NO_COMMENT)
+        , quote(0)
+    {
+    }
+
+    void event(size_t pos)
+    {
+        char c = data[pos];
+
+        if (c == '\n')
+        {
+            emit(pos);
+            line_start = pos + 1;
+            comment = NO_COMMENT;
+            quote = 0;
+            return;
+        }
+
+        if (!del_comms || comment != NO_COMMENT)
+            return;
+
+        // a literal runs to the next quote of its own kind, as in the lexer,
+        // so '"' does not open a string
+        if (quote)
+        {
+            if (c == quote)
+                quote = 0;
+        }
+        else if (c == '"' || c == '\'')
+            quote = c;
+        else if (c == '/' && pos + 1 < size && data[pos + 1] == '/')
+            comment = pos;
+    }
+
+    void finish()
+    {
+        // last line without '\n'
+        if (line_start < size)
+            emit(size);
+    }
+
+    bool wantsComments() const { return del_comms; }
+
+private:
+
+    static constexpr size_t NO_COMMENT = ~size_t(0);
+
+    void emit(size_t line_end)
+    {
+        size_t begin = line_start;
+        size_t end = comment != NO_COMMENT ? comment : line_end;
+
+        if (trim_lines)
+        {
+            while (begin < end && isSpace(data[begin]))
+                begin++;
+            while (end > begin && isSpace(data[end - 1]))
+                end--;
+        }
+
+        spans.push_back({ static_cast<uint32_t>(begin), static_cast<uint32_t>(end - begin) });
+    }
+
+    const char* data;
+    size_t size;
+    bool trim_lines;
+    bool del_comms;
+    std::vector<LineSpan>& spans;
+
+    size_t line_start;
+    size_t comment;
+    char quote;             // of the open literal, 0 - none
+};
+
+static void scanScalar(const char* data, size_t pos, size_t size, LineEmitter& emitter)
+{
+    bool comments = emitter.wantsComments();
+
+    for (; pos < size; pos++)
+    {
+        char c = data[pos];
+        if (c == '\n' || (comments && (c == '/' || c == '"' || c == '\'')))
+            emitter.event(pos);
+    }
+}
+
+#ifdef LINE_SCANNER_X86
+
+TARGET_SSE2 static void scanSSE2(const char* data, size_t size, LineEmitter& emitter)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i apostrophe = _mm_set1_epi8('\'');
+    const bool comments = emitter.wantsComments();
+
+    size_t pos = 0;
+    for (; pos + 16 <= size; pos += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        __m128i hits = _mm_cmpeq_epi8(chunk, nl);
+
+        if (comments)
+        {
+            hits = _mm_or_si128(hits, _mm_or_si128(_mm_cmpeq_epi8(chunk, slash), _mm_cmpeq_epi8(chunk, quote)));
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, apostrophe));
+        }
+
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+        while (mask)
+        {
+            emitter.event(pos + lowestBit(mask));
+            mask &= mask - 1;
+        }
+    }
+
+    scanScalar(data, pos, size, emitter);
+}
+
+TARGET_AVX2 static void scanAVX2(const char* data, size_t size, LineEmitter& emitter)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i slash = _mm256_set1_epi8('/');
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i apostrophe = _mm256_set1_epi8('\'');
+    const bool comments = emitter.wantsComments();
+
+    size_t pos = 0;
+    for (; pos + 32 <= size; pos += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+        __m256i hits = _mm256_cmpeq_epi8(chunk, nl);
+
+        if (comments)
+        {
+            hits = _mm256_or_si256(hits, _mm256_or_si256(_mm256_cmpeq_epi8(chunk, slash), _mm256_cmpeq_epi8(chunk, quote)));
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, apostrophe));
+        }
+
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+        while (mask)
+        {
+            emitter.event(pos + lowestBit(mask));
+            mask &= mask - 1;
+        }
+    }
+
+    scanScalar(data, pos, size, emitter);
+}
+
+static bool cpuHasAVX2()
+{
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7)
+        return false;
+
+    __cpuid(regs, 1);
+    bool osxsave = (regs[2] & (1 << 27)) != 0;
+    bool avx = (regs[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx)
+        return false;
+
+    // OS saves the YMM registers
+    if ((_xgetbv(0) & 0x6) != 0x6)
+        return false;
+
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static bool cpuHasSSE2()
+{
+#if defined(_M_X64) || defined(__x86_64__)
+    return true;
+#elif defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 1);
+    return (regs[3] & (1 << 26)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+#endif
+
+ScannerKind detectScanner()
+{
+#ifdef LINE_SCANNER_X86
+    static const ScannerKind kind =
+        cpuHasAVX2() ? SCANNER_AVX2 :
+        cpuHasSSE2() ? SCANNER_SSE2 :
+        SCANNER_SCALAR;
+    return kind;
+#else
+    return SCANNER_SCALAR;
+#endif
+}
+
+const char* scannerName(ScannerKind kind)
+{
+    switch (kind)
+    {
+    case SCANNER_SSE2:
+        return "SSE2";
+    case SCANNER_AVX2:
+        return "AVX2";
+    default:
+        return "scalar";
+    }
+}
+
+void scanLines(std::string_view text, bool trim_lines, bool del_comms, std::vector<LineSpan>& spans)
+{
+    scanLines(detectScanner(), text, trim_lines, del_comms, spans);
+}
+
+void scanLines(ScannerKind kind, std::string_view text, bool trim_lines, bool del_comms, std::vector<LineSpan>& spans)
+{
+    LineEmitter emitter(text, trim_lines, del_comms, spans);
+
+    switch (kind)
+    {
+#ifdef LINE_SCANNER_X86
+    case SCANNER_AVX2:
+        scanAVX2(text.data(), text.size(), emitter);
+        break;
+    case SCANNER_SSE2:
+        scanSSE2(text.data(), text.size(), emitter);
+        break;
+#endif
+    default:
+        scanScalar(text.data(), 0, text.size(), emitter);
+        break;
+    }
+
+    emitter.finish();
+}
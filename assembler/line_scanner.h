@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common.h"
+
+/*
+	Line splitting kernels.
+
+	Every byte of the source passes through here, so the text is
+	checked 16 (SSE2) or 32 (AVX2) bytes at a time for '\n', '/' and
+	quotes. Chunks without any of them are skipped with one compare; the
+	rare hits are handled by the scalar state machine (comment start
+	outside string and char literals, end of line). The kernel is picked
+	at runtime.
+*/
+
+struct LineSpan
+{
+	uint32_t offset;
+	uint32_t length;
+};
+
+enum ScannerKind
+{
+	SCANNER_SCALAR = 0,
+	SCANNER_SSE2,
+	SCANNER_AVX2,
+};
+
+// Best kernel supported by the running CPU
+ScannerKind detectScanner();
+const char* scannerName(ScannerKind kind);
+
+// Appends spans of the lines of text, same lines as std::getline gives.
+// del_comms cuts a line at "//" outside of a string or char literal,
+// trim_lines narrows it to non-whitespace.
+void scanLines(std::string_view text, bool trim_lines, bool del_comms, std::vector<LineSpan>& spans);
+void scanLines(ScannerKind kind, std::string_view text, bool trim_lines, bool del_comms, std::vector<LineSpan>& spans);
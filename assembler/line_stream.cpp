@@ -0,0 +1,81 @@
+#include "line_stream.h"
+
+LineQueue::LineQueue(size_t max_blocks)
+    : max_blocks(max_blocks)
+    , closed(false)
+    , succeeded(false)
+{
+}
+
+void LineQueue::write(std::string_view text)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [&] { return blocks.size() < max_blocks; });
+
+    blocks.emplace_back(text);
+    not_empty.notify_one();
+}
+
+void LineQueue::close(bool ok)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    succeeded = ok;
+    not_empty.notify_all();
+}
+
+bool LineQueue::pop(std::string& block)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [&] { return closed || !blocks.empty(); });
+
+    if (blocks.empty())
+        return false;
+
+    block = std::move(blocks.front());
+    blocks.pop_front();
+    not_full.notify_one();
+    return true;
+}
+
+bool LineQueue::ok() const
+{
+    return succeeded;
+}
+
+FileSink::FileSink(const std::string& filename, ErrorLog& log)
+    : filename(filename)
+    , tmp_filename(tempFileName(filename))
+    , file(tmp_filename)
+    , log(log)
+{
+}
+
+void FileSink::write(std::string_view text)
+{
+    if (file.is_open())
+        file.write(text.data(), text.size());
+}
+
+void FileSink::close(bool ok)
+{
+    if (!file.is_open())
+    {
+        if (ok)
+            log.addError(ErrorLog::FILE_CANNOT_OPEN, filename, -1);
+        return;
+    }
+
+    file.close();
+
+    std::error_code ec;
+    if (ok && !file.fail())
+    {
+        std::filesystem::rename(tmp_filename, filename, ec);
+        if (!ec)
+            return;
+        log.addError(ErrorLog::FILE_CANNOT_WRITE, filename, -1);
+    }
+
+    std::filesystem::remove(tmp_filename, ec);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "common.h"
+#include "utils.h"
+
+/*
+	Preprocessed text as a stream.
+
+	The preprocessor writes its output in blocks of whole lines, each block
+	ending with '\n', to every TextSink it is given. LineQueue hands the
+	blocks to a consumer on another thread and blocks the producer while
+	it is full, so only a bounded part of the output exists at a time.
+*/
+
+class TextSink
+{
+public:
+
+	virtual ~TextSink() = default;
+
+	// Next block of whole lines
+	virtual void write(std::string_view text) = 0;
+
+	// No more blocks, ok - the producer finished without errors
+	virtual void close(bool ok) = 0;
+};
+
+class LineQueue : public TextSink
+{
+public:
+
+	explicit LineQueue(size_t max_blocks = 16);
+
+	void write(std::string_view text) override;
+	void close(bool ok) override;
+
+	// Next block, false when the queue is closed and empty
+	bool pop(std::string& block);
+
+	// Valid after pop() returned false
+	bool ok() const;
+
+private:
+
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+
+	std::deque<std::string> blocks;
+	size_t max_blocks;
+	bool closed;
+	bool succeeded;
+};
+
+// Collects the whole output
+class StringSink : public TextSink
+{
+public:
+
+	void write(std::string_view text) override { this->text.append(text); }
+	void close(bool) override {}
+
+	std::string text;
+};
+
+// Keeps the output in the blocks it was written in, to be written again elsewhere
+class BlockSink : public TextSink
+{
+public:
+
+	void write(std::string_view text) override { blocks.emplace_back(text); }
+	void close(bool) override {}
+
+	std::vector<std::string> blocks;
+};
+
+// content_hash of the whole output, computed block by block
+class HashSink : public TextSink
+{
+public:
+
+	void write(std::string_view text) override { hash = content_hash(text, hash); }
+	void close(bool) override {}
+
+	uint64_t hash = 14695981039346656037ull;
+};
+
+// Writes the output to a file. It goes to a temporary file first and is
+// renamed on success, a failed run leaves no partial file behind
+class FileSink : public TextSink
+{
+public:
+
+	// Open and write errors go to log
+	FileSink(const std::string& filename, ErrorLog& log);
+
+	void write(std::string_view text) override;
+	void close(bool ok) override;
+
+private:
+
+	std::string filename;
+	std::string tmp_filename;
+	std::ofstream file;
+	ErrorLog& log;
+};
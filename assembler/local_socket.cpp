@@ -0,0 +1,293 @@
+#include "local_socket.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+
+using native_socket = SOCKET;
+static const int SEND_FLAGS = 0;
+
+static void closeSocket(native_socket s) { closesocket(s); }
+static bool interrupted() { return false; }
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+
+using native_socket = int;
+#ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_NOSIGNAL;    // a client gone away is an error, not SIGPIPE
+#else
+static const int SEND_FLAGS = 0;
+#endif
+
+static void closeSocket(native_socket s) { ::close(s); }
+static bool interrupted() { return errno == EINTR; }
+#endif
+
+static const std::uintptr_t NO_SOCKET = ~std::uintptr_t(0);   // INVALID_SOCKET, -1
+
+static native_socket native(std::uintptr_t handle)
+{
+    return static_cast<native_socket>(handle);
+}
+
+// Winsock is started once per process and left running
+static bool startSockets()
+{
+#ifdef _WIN32
+    static bool started = [] {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    return started;
+#else
+    return true;
+#endif
+}
+
+LocalSocket::LocalSocket()
+    : handle(NO_SOCKET)
+{
+}
+
+LocalSocket::~LocalSocket()
+{
+    close();
+}
+
+// A new socket in place of the open one, path only names it in errors
+bool LocalSocket::open(const std::string& path, ErrorLog& log, ErrorLog::ErrorType error)
+{
+    close();
+
+    if (!startSockets())
+    {
+        log.addError(error, path + ": sockets are not available", -1);
+        return false;
+    }
+
+    native_socket s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (static_cast<std::uintptr_t>(s) == NO_SOCKET)
+    {
+        log.addError(error, path + ": cannot create a socket", -1);
+        return false;
+    }
+
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    handle = static_cast<std::uintptr_t>(s);
+    return true;
+}
+
+// Only a socket file is replaced, never whatever else is found on the path
+static bool isSocketFile(const std::string& path)
+{
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributesA(path.c_str());
+    return attributes != INVALID_FILE_ATTRIBUTES
+        && (attributes & FILE_ATTRIBUTE_REPARSE_POINT) && !(attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    std::error_code ec;
+    return std::filesystem::is_socket(path, ec);
+#endif
+}
+
+static bool makeAddress(const std::string& path, sockaddr_un& address)
+{
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    // the terminating zero must fit as well
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+        return false;
+
+    std::memcpy(address.sun_path, path.data(), path.size());
+    return true;
+}
+
+bool LocalSocket::listen(const std::string& path, ErrorLog& log)
+{
+    sockaddr_un address;
+    if (!makeAddress(path, address))
+    {
+        log.addError(ErrorLog::SOCKET_CANNOT_LISTEN, path + ": path is empty or too long", -1);
+        return false;
+    }
+
+    {
+        ErrorLog ignored;
+        LocalSocket probe;
+        if (probe.connect(path, ignored))
+        {
+            log.addError(ErrorLog::SOCKET_CANNOT_LISTEN, path + ": a server is running there", -1);
+            return false;
+        }
+    }
+
+    if (isSocketFile(path))
+    {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+
+    if (!open(path, log, ErrorLog::SOCKET_CANNOT_LISTEN))
+        return false;
+
+    if (::bind(native(handle), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::listen(native(handle), SOMAXCONN) != 0)
+    {
+        close();
+        log.addError(ErrorLog::SOCKET_CANNOT_LISTEN, path, -1);
+        return false;
+    }
+
+    // close() may run after the server changed its directory
+    std::error_code ec;
+    bound_path = std::filesystem::absolute(path, ec).string();
+    if (ec)
+        bound_path = path;
+    return true;
+}
+
+bool LocalSocket::accept(LocalSocket& client)
+{
+    client.close();
+
+    while (true)
+    {
+        native_socket s = ::accept(native(handle), nullptr, nullptr);
+        if (static_cast<std::uintptr_t>(s) != NO_SOCKET)
+        {
+            client.handle = static_cast<std::uintptr_t>(s);
+            return true;
+        }
+        if (!interrupted())
+            return false;
+    }
+}
+
+bool LocalSocket::connect(const std::string& path, ErrorLog& log)
+{
+    sockaddr_un address;
+    if (!makeAddress(path, address))
+    {
+        log.addError(ErrorLog::SOCKET_CANNOT_CONNECT, path + ": path is empty or too long", -1);
+        return false;
+    }
+
+    if (!open(path, log, ErrorLog::SOCKET_CANNOT_CONNECT))
+        return false;
+
+    if (::connect(native(handle), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        close();
+        log.addError(ErrorLog::SOCKET_CANNOT_CONNECT, path, -1);
+        return false;
+    }
+
+    return true;
+}
+
+void LocalSocket::close()
+{
+    if (handle == NO_SOCKET)
+        return;
+
+    closeSocket(native(handle));
+    handle = NO_SOCKET;
+
+    if (!bound_path.empty())
+    {
+        std::error_code ec;
+        std::filesystem::remove(bound_path, ec);
+        bound_path.clear();
+    }
+}
+
+// The whole message goes out in one buffer, a small request is one packet
+bool LocalSocket::send(const std::vector<std::string>& message)
+{
+    std::string buffer;
+    uint32_t count = static_cast<uint32_t>(message.size());
+    buffer.append(reinterpret_cast<const char*>(&count), sizeof(count));
+
+    for (const auto& str : message)
+    {
+        uint32_t size = static_cast<uint32_t>(str.size());
+        buffer.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        buffer.append(str);
+    }
+
+    return sendAll(buffer.data(), buffer.size());
+}
+
+// Sizes past the limits are a broken peer, not something to allocate for
+bool LocalSocket::receive(std::vector<std::string>& message)
+{
+    message.clear();
+
+    uint32_t count = 0;
+    if (!receiveAll(&count, sizeof(count)) || count > MAX_STRINGS)
+        return false;
+
+    message.resize(count);
+
+    for (auto& str : message)
+    {
+        uint32_t size = 0;
+        if (!receiveAll(&size, sizeof(size)) || size > MAX_STRING_SIZE)
+            return false;
+
+        str.resize(size);
+        if (size && !receiveAll(&str[0], size))
+            return false;
+    }
+
+    return true;
+}
+
+bool LocalSocket::sendAll(const void* data, size_t size)
+{
+    const char* next = static_cast<const char*>(data);
+
+    while (size > 0)
+    {
+        int chunk = static_cast<int>(std::min<size_t>(size, 1 << 30));
+        auto sent = ::send(native(handle), next, chunk, SEND_FLAGS);
+        if (sent < 0 && interrupted())
+            continue;
+        if (sent <= 0)
+            return false;
+
+        next += sent;
+        size -= static_cast<size_t>(sent);
+    }
+
+    return true;
+}
+
+bool LocalSocket::receiveAll(void* data, size_t size)
+{
+    char* next = static_cast<char*>(data);
+
+    while (size > 0)
+    {
+        int chunk = static_cast<int>(std::min<size_t>(size, 1 << 30));
+        auto received = ::recv(native(handle), next, chunk, 0);
+        if (received < 0 && interrupted())
+            continue;
+        if (received <= 0)
+            return false;
+
+        next += received;
+        size -= static_cast<size_t>(received);
+    }
+
+    return true;
+}
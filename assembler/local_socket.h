@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common.h"
+
+/*
+	Stream socket on a path of the local file system - a Unix domain
+	socket, which Windows 10 has as well.
+
+	What goes over it are messages: lists of strings, each message the
+	number of strings, then every string as its length and its bytes.
+	Both ends are on one machine, so numbers go in host byte order.
+*/
+
+class LocalSocket
+{
+public:
+
+	LocalSocket();
+	~LocalSocket();
+
+	LocalSocket(const LocalSocket&) = delete;
+	LocalSocket& operator=(const LocalSocket&) = delete;
+
+	// Takes over the path; a socket file nobody answers on is left over
+	// from a server that died and is replaced
+	bool listen(const std::string& path, ErrorLog& log);
+
+	// Waits for the next client, false - the listening socket broke
+	bool accept(LocalSocket& client);
+
+	bool connect(const std::string& path, ErrorLog& log);
+
+	bool send(const std::vector<std::string>& message);
+	bool receive(std::vector<std::string>& message);
+
+	void close();
+
+private:
+
+	static const uint32_t MAX_STRINGS = 4096;
+	static const uint32_t MAX_STRING_SIZE = 256 * 1024 * 1024;
+
+	bool open(const std::string& path, ErrorLog& log, ErrorLog::ErrorType error);
+	bool sendAll(const void* data, size_t size);
+	bool receiveAll(void* data, size_t size);
+
+	std::uintptr_t handle;      // SOCKET or file descriptor
+	std::string bound_path;     // removed when a listening socket closes
+};
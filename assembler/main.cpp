@@ -2,92 +2,752 @@
 
 #include "assembler.h"
 #include "preprocessor.h"
+#include "build_cache.h"
+#include "local_socket.h"
 
 
-int main(int argc, char* argv[]) {
+// -D names and values, ordered so equal sets compare and hash the same
+using Defines = std::map<std::string, std::string>;
+
+struct BuildOptions
+{
+    bool verilog = false;
+    bool verbose = false;
+    bool prep_out = false;
+    bool stream_mode = false;
+    int rom_size = 16384;
+    int threads = 0;
+    std::string pch_dir;
+    std::string cache_dir;
+    Defines defines;
+};
 
+// What the jobs of one run share, nullptr - each job has its own
+struct BuildShared
+{
+    WorkPool* pool = nullptr;
+    SharedIncludes* includes = nullptr;
+    SharedSnapshots* snapshots = nullptr;
+    Assembler::ChunkCache* chunks = nullptr;
+    IncludePrefetch* prefetch = nullptr;
+};
+
+// One output of a batch or a matrix and what became of it
+struct BuildJob
+{
+    std::string label;              // how the summary names it - the input or the defines
     std::string input_filename;
     std::string output_filename;
-    std::vector<instruction_t> instrs;
+    Defines defines;
+    ErrorLog log;
+    bool ok = false;
+    double seconds = 0;
+};
 
-    if (argc < 3)
-    {
-        std::cout << "Usage: asm.exe <inputfile> <outputfile>\noptional:\n\t-rom_size\n\t-verbose\n\t-verilog\n\t-preprocess_out" << std::endl;
-        return EXIT_FAILURE;
-    }
+// Writes the preprocessed text of one build to the sinks and closes them, false on errors
+using Producer = std::function<bool(Preprocessor& prepr, const std::vector<TextSink*>& sinks)>;
 
-    input_filename = argv[1];
-    output_filename = argv[2];
 
-    bool verilog = false;
-    bool verbose = false;
-    bool prep_out = false;
-    int rom_size = 16384;
+static const char* USAGE =
+    "Usage: asm.exe <inputfile> <outputfile> [options]\n"
+    "       asm.exe -batch <manifest|-> [options]\n"
+    "       asm.exe -matrix <configs> <inputfile> [options]\n"
+    "       asm.exe -server <socket> [-threads <n>] [-verbose]\n"
+    "       asm.exe -client <socket> <inputfile> <outputfile> [options]\n"
+    "       asm.exe -client <socket> -stop\n"
+    "optional:\n\t-rom_size\n\t-verbose\n\t-verilog\n\t-preprocess_out\n\t-pch <dir>\n\t-cache <dir>\n\t-stream\n\t-threads <n>\n\t-D <name>[=<value>]";
+
+
+// NAME=VALUE, or NAME alone for 1
+static void addDefine(Defines& defines, const std::string& text)
+{
+    size_t eq = text.find('=');
+
+    if (eq == std::string::npos)
+        defines[text] = "1";
+    else
+        defines[text.substr(0, eq)] = text.substr(eq + 1);
+}
+
+// The defines are part of the input, a build is cached per set of them
+static uint64_t withDefines(uint64_t source_hash, const Defines& defines)
+{
+    for (const auto& [name, value] : defines)
+        source_hash = content_hash(name + "=" + value + "\n", source_hash);
+
+    return source_hash;
+}
+
 
+static bool parseOptions(int argc, char* argv[], int first, BuildOptions& options, std::ostream& out = std::cout)
+{
     bool bad_param = false;
 
-    for (int i = 3; i < argc; i++)
+    for (int i = first; i < argc; i++)
     {
         std::string str = argv[i];
-        if (str == "-rom_size")
+        if (str == "-rom_size" && i + 1 < argc)
         {
-            rom_size = std::stoi(argv[i + 1]);
+            options.rom_size = std::stoi(argv[i + 1]);
             i++;
         }
         else if (str == "-verbose")
         {
-            verbose = true;
+            options.verbose = true;
         }
         else if (str == "-verilog")
         {
-            verilog = true;
+            options.verilog = true;
         }
         else if (str == "-preprocess_out")
         {
-            prep_out = true;
+            options.prep_out = true;
+        }
+        else if (str == "-stream")
+        {
+            options.stream_mode = true;
+        }
+        else if (str == "-threads" && i + 1 < argc)
+        {
+            options.threads = std::max(0, std::stoi(argv[i + 1]));
+            i++;
+        }
+        else if (str == "-pch" && i + 1 < argc)
+        {
+            options.pch_dir = argv[i + 1];
+            i++;
+        }
+        else if (str == "-cache" && i + 1 < argc)
+        {
+            options.cache_dir = argv[i + 1];
+            i++;
+        }
+        else if (str == "-D" && i + 1 < argc)
+        {
+            addDefine(options.defines, argv[i + 1]);
+            i++;
+        }
+        else if (str.size() > 2 && str.compare(0, 2, "-D") == 0)
+        {
+            addDefine(options.defines, str.substr(2));
         }
         else
         {
-            std::cout << "Unexcepted parameter " << str << std::endl;
+            out << "Unexcepted parameter " << str << std::endl;
             bad_param = true;
         }
     }
 
-    if (bad_param) 
+    if (bad_param)
     {
-        std::cout << "You can only use -rom_size, -verbose, -verilog" << std::endl;
-        return EXIT_FAILURE;
+        out << "You can only use -rom_size, -verbose, -verilog, -preprocess_out, -pch, -cache, -stream, -threads, -D" << std::endl;
+        return false;
     }
 
+    return true;
+}
+
+// One output from text a producer preprocesses: the build cache lookup,
+// the assembler consuming the text while it is produced, the output file.
+// Every instance reports to its own log, they are collected into log in order
+static bool assembleOutput(const std::string& output_filename, uint64_t source_hash, const BuildOptions& options,
+                           const Defines& defines, const BuildShared& shared, ErrorLog& log, const Producer& produce)
+{
+    std::vector<instruction_t> instrs;
+
     Assembler asmblr;
     Preprocessor prepr;
+    BuildCache cache;
+    prepr.setSnapshotDir(options.pch_dir);
+    prepr.setSharedIncludes(shared.includes);
+    prepr.setSharedSnapshots(shared.snapshots);
+    prepr.setPrefetch(shared.prefetch);
+    for (const auto& [name, value] : defines)
+        prepr.define(name, value);
+    cache.setDir(options.cache_dir);
+    asmblr.setThreads(options.threads);
+    asmblr.setPool(shared.pool);
+    asmblr.setChunkCache(shared.chunks);
+    asmblr.setPrefetch(shared.prefetch);
+
+    bool verbose = options.verbose;
+
+    // a hit skips preprocessing and assembling, -preprocess_out always runs both
+    bool cached = false;
+    bool written = false;
+    uint64_t preprocessed_hash = 0;
+
+    if (cache.enabled())
+    {
+        cache.begin(source_hash, options.rom_size, options.verilog, verbose);
+        cached = !options.prep_out && cache.fetch(output_filename);
+    }
+    if (!cached)
+    {
+        // the preprocessor streams its output, the assembler's first pass
+        // consumes it on another thread while the rest is being produced
+        LineQueue stream;
+        HashSink hash;
+        ErrorLog prep_file_errors;
+        std::unique_ptr<FileSink> prep_file;
+
+        std::vector<TextSink*> sinks = { &stream };
+        if (options.prep_out)
+        {
+            prep_file = std::make_unique<FileSink>(output_filename + ".prep", prep_file_errors);
+            sinks.push_back(prep_file.get());
+        }
+        if (cache.enabled())
+            sinks.push_back(&hash);
+
+        std::unique_ptr<RomFile> rom_file;
+        if (options.stream_mode)
+            rom_file = std::make_unique<RomFile>(output_filename, options.verilog, options.rom_size);
+
+        std::thread consumer([&]() {
+            if (rom_file)
+                written = asmblr.assemble(stream, *rom_file, options.rom_size, verbose);
+            else
+                instrs = asmblr.assemble(stream, options.rom_size, verbose);
+        });
+
+        bool preprocessed = produce(prepr, sinks);
+        consumer.join();
+
+        log.append(prepr.diagnostics());
+        log.append(prep_file_errors);
+
+        if (!log.has_errors())
+        {
+            if (!preprocessed)
+                instrs = asmblr.assemble(std::string(), options.rom_size, verbose);     // a failed preprocess yields no text
+            log.append(asmblr.diagnostics());
+        }
+        preprocessed_hash = hash.hash;
+    }
+    if (!log.has_errors() && !cached && !written)
+    {
+        writeFile(instrs, output_filename, log, verbose, options.verilog);
+    }
+    if (!log.has_errors() && !cached && cache.enabled())
+    {
+        cache.store(output_filename, preprocessed_hash, prepr.includedFiles(), asmblr.binaryFiles());
+    }
+
+    return !log.has_errors();
+}
 
-    qprintf(verbose, 1, "readFile\n%s", input_filename.c_str());
+// Assembles one input into one output
+static bool build(const std::string& input_filename, const std::string& output_filename,
+                  const BuildOptions& options, const BuildShared& shared, ErrorLog& log)
+{
+    bool verbose = options.verbose;
+    bool cache_enabled = !options.cache_dir.empty();
+
+    // -stream: the source is read in blocks and data goes straight to the output
+    // file, so memory does not grow with the size of data tables
     std::string source_code;
+    uint64_t source_hash = 0;
+
+    if (!options.stream_mode)
+    {
+        qprintf(verbose, 1, "readFile\n%s", input_filename.c_str());
+        readFile(input_filename, source_code, log, verbose);
+        if (cache_enabled)
+            source_hash = content_hash(source_code);
+    }
+    else if (cache_enabled && !file_content_hash(input_filename, source_hash))
+    {
+        log.addError(ErrorLog::FILE_CANNOT_OPEN, input_filename, -1);
+    }
+
+    if (log.has_errors())
+        return false;
+
+    return assembleOutput(output_filename, withDefines(source_hash, options.defines), options, options.defines, shared, log,
+        [&](Preprocessor& prepr, const std::vector<TextSink*>& sinks) {
+            return options.stream_mode
+                ? prepr.preprocessFile(input_filename, sinks, verbose)
+                : prepr.preprocess(std::move(source_code), sinks, verbose);
+        });
+}
+
+// Manifests and configuration lists: "-" reads stdin, empty lines and
+// lines starting with # are skipped, the rest go to parse one by one
+static bool readList(const std::string& filename, ErrorLog& log,
+                     const std::function<void(std::istringstream& fields, int line_num)>& parse)
+{
+    std::ifstream file;
+    std::istream* in = &std::cin;
+
+    if (filename != "-")
+    {
+        file.open(filename);
+        if (!file.is_open())
+        {
+            log.addError(ErrorLog::FILE_CANNOT_OPEN, filename, -1);
+            return false;
+        }
+        in = &file;
+    }
+
+    std::string line;
+    int line_num = 0;
+
+    while (std::getline(*in, line))
+    {
+        line_num++;
+
+        std::istringstream fields(line);
+        fields >> std::ws;
+        if (fields.eof() || fields.peek() == '#')
+            continue;
+
+        parse(fields, line_num);
+    }
+
+    return !log.has_errors();
+}
+
+// One job per line: <input> <output>, names with spaces are quoted
+static bool readManifest(const std::string& filename, std::vector<BuildJob>& jobs, ErrorLog& log)
+{
+    return readList(filename, log, [&](std::istringstream& fields, int line_num) {
+        BuildJob job;
+        std::string extra;
+        fields >> std::quoted(job.input_filename) >> std::quoted(job.output_filename);
+
+        if (!fields || (fields >> extra))
+        {
+            log.addError(ErrorLog::FILE_CANNOT_READ, filename + ": expected <input> <output>", line_num);
+            return;
+        }
+
+        job.label = job.input_filename;
+        jobs.push_back(std::move(job));
+    });
+}
+
+// One configuration per line: <output> [NAME[=VALUE] ...], on top of the -D ones
+static bool readConfigs(const std::string& filename, const BuildOptions& options, std::vector<BuildJob>& jobs, ErrorLog& log)
+{
+    bool result = readList(filename, log, [&](std::istringstream& fields, int line_num) {
+        BuildJob job;
+        std::string define;
+        job.defines = options.defines;
+
+        if (!(fields >> std::quoted(job.output_filename)))
+        {
+            log.addError(ErrorLog::FILE_CANNOT_READ, filename + ": expected <output> [NAME[=VALUE] ...]", line_num);
+            return;
+        }
+
+        while (fields >> define)
+            addDefine(job.defines, define);
 
-    readFile(input_filename, source_code, verbose);
+        for (const auto& [name, value] : job.defines)
+            job.label += (job.label.empty() ? "" : " ") + name + "=" + value;
+        job.label = "[" + job.label + "]";
 
-    if (!error_log.has_errors())
+        jobs.push_back(std::move(job));
+    });
+
+    if (result && jobs.empty())
     {
-        source_code = prepr.preprocess(source_code, verbose);
+        log.addError(ErrorLog::FILE_CANNOT_READ, filename + ": no configurations", -1);
+        result = false;
     }
-    if (!error_log.has_errors() && prep_out)
+
+    return result;
+}
+
+// Reported after all jobs finished, in list order: the errors of the failed
+// ones, then a line per job
+static int reportJobs(const char* title, const std::vector<BuildJob>& jobs, double seconds, unsigned threads)
+{
+    size_t failed = 0;
+
+    for (const auto& job : jobs)
     {
-        writeFile(output_filename + ".prep", source_code, verbose);
+        if (job.ok)
+            continue;
+
+        failed++;
+        std::cout << "=== " << job.label << " ===" << std::endl;
+        std::cout << job.log.getErrors() << std::endl;
     }
-    if (!error_log.has_errors())
+
+    std::cout << "==================== " << title << " ====================" << std::endl;
+    for (const auto& job : jobs)
     {
-        instrs = asmblr.assemble(source_code, rom_size, verbose);
+        std::cout << (job.ok ? "  ok    " : "  FAILED") << "  " << job.label << " -> " << job.output_filename
+                  << qsprintf("  (%.1f ms)", job.seconds * 1000) << std::endl;
     }
-    if (!error_log.has_errors())
+    std::cout << qsprintf("%zu jobs, %zu failed, %.3f s on %u threads, %.1f jobs/s",
+                          jobs.size(), failed, seconds, threads, seconds > 0 ? jobs.size() / seconds : 0.0) << std::endl;
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Jobs and the passes inside them share one work-stealing pool, so a few
+// big programs still use every thread once the small ones are done
+static int runBatch(const std::string& manifest, const BuildOptions& options)
+{
+    ErrorLog log;
+    std::vector<BuildJob> jobs;
+
+    if (!readManifest(manifest, jobs, log))
     {
-        writeFile(instrs, output_filename, verbose, verilog);
+        std::cout << log.getErrors() << std::endl;
+        return EXIT_FAILURE;
     }
-    if (error_log.has_errors())
+
+    unsigned threads = options.threads > 0 ? options.threads : defaultThreadCount();
+    WorkPool pool(threads);
+    SharedIncludes includes;
+    IncludePrefetch prefetch;
+
+    BuildShared shared;
+    shared.pool = &pool;
+    shared.includes = &includes;
+    shared.prefetch = &prefetch;
+
+    auto start = std::chrono::steady_clock::now();
+
+    pool.run(jobs.size(), [&](size_t i) {
+        BuildJob& job = jobs[i];
+        auto job_start = std::chrono::steady_clock::now();
+
+        job.ok = build(job.input_filename, job.output_filename, options, shared, job.log);
+        job.seconds = secondsSince(job_start);
+    });
+
+    return reportJobs("BATCH SUMMARY", jobs, secondsSince(start), threads);
+}
+
+// One source under every configuration of the list. Names all of them
+// define alike go in before the first line; the lines up to the first one
+// that names any other define are preprocessed once, and every configuration
+// forks from there in parallel. Their assemblers share analyzed chunks, so
+// the common text is analyzed once as well
+static int runMatrix(const std::string& configs, const std::string& input_filename, const BuildOptions& options)
+{
+    ErrorLog log;
+    std::vector<BuildJob> jobs;
+    std::string source_code;
+
+    if (readConfigs(configs, options, jobs, log))
+    {
+        qprintf(options.verbose, 1, "readFile\n%s", input_filename.c_str());
+        readFile(input_filename, source_code, log, options.verbose);
+    }
+
+    if (log.has_errors())
+    {
+        std::cout << log.getErrors() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Defines common = jobs.front().defines;
+    std::set<std::string> fork_names;
+
+    for (const auto& job : jobs)
+    {
+        for (auto it = common.begin(); it != common.end(); )
+        {
+            auto own = job.defines.find(it->first);
+            if (own != job.defines.end() && own->second == it->second)
+            {
+                it++;
+                continue;
+            }
+
+            fork_names.insert(it->first);
+            it = common.erase(it);
+        }
+
+        for (const auto& define : job.defines)
+        {
+            if (!common.count(define.first))
+                fork_names.insert(define.first);
+        }
+    }
+
+    uint64_t source_hash = options.cache_dir.empty() ? 0 : content_hash(source_code);
+
+    unsigned threads = options.threads > 0 ? options.threads : defaultThreadCount();
+    WorkPool pool(threads);
+    SharedIncludes includes;
+    Assembler::ChunkCache chunks;
+    IncludePrefetch prefetch;
+
+    BuildShared shared;
+    shared.pool = &pool;
+    shared.includes = &includes;
+    shared.chunks = &chunks;
+    shared.prefetch = &prefetch;
+
+    auto start = std::chrono::steady_clock::now();
+
+    // the prefix is kept in the blocks it was flushed in, so every configuration
+    // gets the same queue blocks and its assembler finds them analyzed
+    BlockSink prefix;
+    Preprocessor base;
+    base.setSnapshotDir(options.pch_dir);
+    base.setSharedIncludes(&includes);
+    base.setPrefetch(&prefetch);
+    for (const auto& [name, value] : common)
+        base.define(name, value);
+
+    base.preprocessPrefix(std::move(source_code), std::vector<std::string>(fork_names.begin(), fork_names.end()),
+        { &prefix }, options.verbose);
+
+    pool.run(jobs.size(), [&](size_t i) {
+        BuildJob& job = jobs[i];
+        auto job_start = std::chrono::steady_clock::now();
+
+        Defines own;
+        for (const auto& [name, value] : job.defines)
+        {
+            if (!common.count(name))
+                own[name] = value;
+        }
+
+        job.ok = assembleOutput(job.output_filename, withDefines(source_hash, job.defines), options, own, shared, job.log,
+            [&](Preprocessor& prepr, const std::vector<TextSink*>& sinks) {
+                for (const auto& block : prefix.blocks)
+                {
+                    for (auto* sink : sinks)
+                        sink->write(block);
+                }
+                return prepr.preprocessFork(base, sinks, options.verbose);
+            });
+        job.seconds = secondsSince(job_start);
+    });
+
+    qprintf(options.verbose, 1, "CHUNK CACHE: %zu hits, %zu misses", chunks.hits(), chunks.misses());
+    qprintf(options.verbose, 1, "PREFETCH: %zu files read ahead", prefetch.prefetched());
+
+    return reportJobs("MATRIX SUMMARY", jobs, secondsSince(start), threads);
+}
+
+// A -client request is a command followed by its arguments. A build sends
+// the client's working directory and its command line after the socket,
+// the reply is the exit code and what a run of its own would have printed
+static const char* REQUEST_BUILD = "build";
+static const char* REQUEST_STOP = "stop";
+
+// args - the working directory, the input, the output and the options
+static int serveBuild(std::vector<std::string>& args, const BuildShared& shared, std::ostream& out)
+{
+    ErrorLog log;
+    std::error_code ec;
+
+    std::filesystem::current_path(args[0], ec);
+    if (ec)
+    {
+        log.addError(ErrorLog::FILE_CANNOT_OPEN, args[0], -1);
+        out << log.getErrors() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // laid out like the argv of main(), the directory stands in for the program
+    std::vector<char*> argv;
+    for (auto& arg : args)
+        argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+
+    int argc = static_cast<int>(args.size());
+    BuildOptions options;
+
+    if (argc < 3)
+    {
+        out << USAGE << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // a bad number must not take the server down with it
+    try
+    {
+        if (!parseOptions(argc, argv.data(), 3, options, out))
+            return EXIT_FAILURE;
+    }
+    catch (const std::exception&)
+    {
+        out << "Invalid option value" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!build(argv[1], argv[2], options, shared, log))
+    {
+        out << log.getErrors() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Builds for -client without starting a process each. The work pool, the
+// include files and the header snapshots stay warm between requests, an
+// include whose mtime changed is read again and a header whose content
+// changed is snapshotted again. Requests run one at a time, each in its
+// client's directory, and the server returns to its own after every one.
+// Analyzed chunks are not kept, they would miss a changed .include_bin.
+// -verbose output of the builds stays on this console
+static int runServer(const std::string& socket_path, const BuildOptions& options)
+{
+    ErrorLog log;
+    LocalSocket server;
+
+    if (!server.listen(socket_path, log))
+    {
+        std::cout << log.getErrors() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    unsigned threads = options.threads > 0 ? options.threads : defaultThreadCount();
+    WorkPool pool(threads);
+    SharedIncludes includes;
+    SharedSnapshots snapshots;
+
+    BuildShared shared;
+    shared.pool = &pool;
+    shared.includes = &includes;
+    shared.snapshots = &snapshots;
+
+    // every request moves into its client's directory, the server comes back here
+    std::error_code ec;
+    const auto server_dir = std::filesystem::current_path(ec);
+
+    std::cout << "Listening on " << socket_path << std::endl;
+
+    LocalSocket client;
+    std::vector<std::string> request;
+
+    while (server.accept(client))
+    {
+        if (!client.receive(request) || request.empty())
+            continue;
+
+        if (request[0] == REQUEST_STOP)
+        {
+            client.send({ std::to_string(EXIT_SUCCESS), std::string() });
+            return EXIT_SUCCESS;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::ostringstream out;
+        int code = EXIT_FAILURE;
+
+        if (request[0] == REQUEST_BUILD && request.size() > 1)
+        {
+            request.erase(request.begin());
+            code = serveBuild(request, shared, out);
+            std::filesystem::current_path(server_dir, ec);
+        }
+        else
+        {
+            out << "Unknown request " << request[0] << std::endl;
+        }
+
+        client.send({ std::to_string(code), out.str() });
+        qprintf(options.verbose, 1, "REQUEST: %s in %.3f ms", code == EXIT_SUCCESS ? "ok" : "failed", secondsSince(start) * 1000);
+    }
+
+    std::cout << "The server socket failed" << std::endl;
+    return EXIT_FAILURE;
+}
+
+// Hands the command line to a -server and prints what it replies
+static int runClient(const std::string& socket_path, int argc, char* argv[], int first)
+{
+    ErrorLog log;
+    LocalSocket server;
+
+    if (!server.connect(socket_path, log))
+    {
+        std::cout << log.getErrors() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string> request;
+
+    if (std::string(argv[first]) == "-stop")
+    {
+        request = { REQUEST_STOP };
+    }
+    else
+    {
+        std::error_code ec;
+        request = { REQUEST_BUILD, std::filesystem::current_path(ec).string() };
+        request.insert(request.end(), argv + first, argv + argc);
+    }
+
+    std::vector<std::string> reply;
+
+    if (!server.send(request) || !server.receive(reply) || reply.size() != 2)
+    {
+        log.addError(ErrorLog::SOCKET_CANNOT_CONNECT, socket_path + ": no reply", -1);
+        std::cout << log.getErrors() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << reply[1];
+    return std::atoi(reply[0].c_str());
+}
+
+
+int main(int argc, char* argv[]) {
+
+    if (argc < 3)
+    {
+        std::cout << USAGE << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string mode = argv[1];
+    bool matrix = mode == "-matrix";
+
+    if ((matrix || mode == "-client") && argc < 4)
+    {
+        std::cout << USAGE << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // the server parses the options, its reply tells about bad ones
+    if (mode == "-client")
+        return runClient(argv[2], argc, argv, 3);
+
+    BuildOptions options;
+    if (!parseOptions(argc, argv, matrix ? 4 : 3, options))
+        return EXIT_FAILURE;
+
+    if (mode == "-batch")
+        return runBatch(argv[2], options);
+    if (matrix)
+        return runMatrix(argv[2], argv[3], options);
+    if (mode == "-server")
+        return runServer(argv[2], options);
+
+    // include files are read ahead while the source is preprocessed
+    IncludePrefetch prefetch;
+    BuildShared shared;
+    shared.prefetch = &prefetch;
+
+    ErrorLog log;
+    bool built = build(argv[1], argv[2], options, shared, log);
+    qprintf(options.verbose, 1, "PREFETCH: %zu files read ahead", prefetch.prefetched());
+
+    if (!built)
     {
-        std::cout << error_log.getErrors() << std::endl;
+        std::cout << log.getErrors() << std::endl;
         return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -4,8 +4,7 @@
 // There are only one Immediate operation - LWI
 
 
-const std::map<std::string, INSTRUCTION_META> INSTRUCTIONS
-{
+inline constexpr auto INSTRUCTIONS = make_perfect_hash<INSTRUCTION_META, 7, 0x811c9debu>({
     // No func opcodes
     { "NOP", {0, OPCODE_NOP} },
     { "HLT", {0, OPCODE_HLT} },
@@ -47,7 +46,9 @@ const std::map<std::string, INSTRUCTION_META> INSTRUCTIONS
     { "SRA", {3, OPCODE_SRA} },
     { "AND", {3, OPCODE_AND} },
     { "ORR", {3, OPCODE_ORR} },
-};
+});
+
+static_assert(INSTRUCTIONS.is_perfect(), "INSTRUCTIONS hash collision - pick another seed");
 
 /*
      ============================================================================
@@ -0,0 +1,191 @@
+#include "parallel.h"
+
+unsigned defaultThreadCount()
+{
+    unsigned threads = std::thread::hardware_concurrency();
+    return threads ? threads : 1;
+}
+
+void parallelFor(size_t count, unsigned threads, const std::function<void(size_t)>& task)
+{
+    std::atomic<size_t> next(0);
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++)
+            task(i);
+    };
+
+    size_t workers_num = std::min<size_t>(std::max(threads, 1u), count);
+
+    std::vector<std::thread> workers;
+    workers.reserve(workers_num);
+
+    for (size_t i = 0; i < workers_num; i++)
+        workers.emplace_back(worker);
+
+    for (auto& w : workers)
+        w.join();
+}
+
+WorkPool::WorkPool(unsigned threads)
+    : queued(0)
+    , stopping(false)
+{
+    threads = std::max(threads, 1u);
+
+    for (unsigned i = 0; i < threads; i++)
+        workers.push_back(std::make_unique<Worker>());
+
+    this->threads.reserve(threads);
+    for (unsigned i = 0; i < threads; i++)
+        this->threads.emplace_back(&WorkPool::workerLoop, this, i);
+}
+
+WorkPool::~WorkPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+unsigned WorkPool::size() const
+{
+    return static_cast<unsigned>(workers.size());
+}
+
+void WorkPool::run(size_t count, const std::function<void(size_t)>& task)
+{
+    if (count == 0)
+        return;
+
+    Batch batch;
+    batch.task = &task;
+    batch.pending = count;
+    batch.queued = count;
+
+    // a worker keeps the tasks for the others to steal, from outside they are dealt out
+    size_t self = workerIndex();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        Worker& worker = *workers[self < workers.size() ? self : i % workers.size()];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back({ &batch, i });
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued += count;
+    }
+    wake.notify_all();
+
+    while (batch.pending > 0)
+    {
+        Task next;
+        if (takeTask(self, &batch, next))
+        {
+            execute(next);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return batch.pending == 0 || batch.queued > 0; });
+    }
+}
+
+// workers.size() - the calling thread is not a worker of this pool
+size_t WorkPool::workerIndex() const
+{
+    std::thread::id id = std::this_thread::get_id();
+
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        if (threads[i].get_id() == id)
+            return i;
+    }
+
+    return workers.size();
+}
+
+// Own deque newest first, then the oldest task of the next workers.
+// only - take a task of that batch or nothing
+bool WorkPool::takeTask(size_t self, const Batch* only, Task& task)
+{
+    auto matches = [&](const Task& t) { return !only || t.batch == only; };
+    bool found = false;
+
+    if (self < workers.size())
+    {
+        Worker& own = *workers[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+
+        auto it = std::find_if(own.tasks.rbegin(), own.tasks.rend(), matches);
+        if (it != own.tasks.rend())
+        {
+            task = *it;
+            own.tasks.erase(std::next(it).base());
+            found = true;
+        }
+    }
+
+    for (size_t i = 1; !found && i <= workers.size(); i++)
+    {
+        Worker& victim = *workers[(self + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        auto it = std::find_if(victim.tasks.begin(), victim.tasks.end(), matches);
+        if (it != victim.tasks.end())
+        {
+            task = *it;
+            victim.tasks.erase(it);
+            found = true;
+        }
+    }
+
+    if (found)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued--;
+        task.batch->queued--;
+    }
+
+    return found;
+}
+
+void WorkPool::execute(const Task& task)
+{
+    (*task.batch->task)(task.index);
+
+    // the batch may be gone as soon as pending drops to zero
+    if (--task.batch->pending == 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+        }
+        wake.notify_all();
+    }
+}
+
+void WorkPool::workerLoop(size_t self)
+{
+    for (;;)
+    {
+        Task next;
+        if (takeTask(self, nullptr, next))
+        {
+            execute(next);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return stopping || queued > 0; });
+
+        if (stopping && queued == 0)
+            return;
+    }
+}
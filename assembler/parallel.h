@@ -0,0 +1,73 @@
+#pragma once
+
+#include "common.h"
+
+// One worker per hardware thread
+unsigned defaultThreadCount();
+
+// Runs task(i) for every i in [0, count) on up to `threads` new worker
+// threads and waits for all of them. Tasks are handed out one at a time,
+// so uneven tasks still balance. The calling thread only waits.
+void parallelFor(size_t count, unsigned threads, const std::function<void(size_t)>& task);
+
+
+/*
+	Work-stealing pool.
+
+	Every worker has a deque of tasks. It runs its own newest task first
+	and, when its deque is empty, steals the oldest task of another
+	worker. run() called on a worker queues the tasks on that worker and
+	the others steal them, so a task can split itself further. A thread
+	waiting in run() runs tasks of its own call meanwhile, never someone
+	else's, so a short wait does not turn into a long one.
+*/
+class WorkPool
+{
+public:
+
+	explicit WorkPool(unsigned threads);
+	~WorkPool();
+
+	WorkPool(const WorkPool&) = delete;
+	WorkPool& operator=(const WorkPool&) = delete;
+
+	unsigned size() const;
+
+	// Runs task(i) for every i in [0, count) and waits for all of them
+	void run(size_t count, const std::function<void(size_t)>& task);
+
+private:
+
+	struct Batch
+	{
+		const std::function<void(size_t)>* task;
+		std::atomic<size_t> pending;    // not finished
+		size_t queued;                  // still in the deques, guarded by mutex
+	};
+
+	struct Task
+	{
+		Batch* batch;
+		size_t index;
+	};
+
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	size_t workerIndex() const;
+	bool takeTask(size_t self, const Batch* only, Task& task);
+	void execute(const Task& task);
+	void workerLoop(size_t self);
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+
+	// sleeping workers and waiting run() calls wake up on new tasks and finished batches
+	std::mutex mutex;
+	std::condition_variable wake;
+	size_t queued;              // tasks in the deques, guarded by mutex
+	bool stopping;
+};
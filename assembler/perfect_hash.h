@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+
+/*
+	Compile-time perfect hash tables for the fixed name sets
+	(opcodes, directives). Tables are built by the compiler, so there is
+	no heap and no static initialization; a lookup is one hash and
+	one string compare.
+
+	Seeds are picked offline - if a table gets a collision after
+	editing, the static_assert next to it fires and a new seed is needed.
+*/
+
+constexpr uint32_t name_hash(std::string_view name, uint32_t seed)
+{
+	// FNV-1a with a seeded basis and a final mix for the short names
+	uint32_t h = seed;
+	for (char c : name)
+	{
+		h ^= static_cast<uint8_t>(c);
+		h *= 16777619u;
+	}
+	h ^= h >> 16;
+	h *= 0x45d9f3bu;
+	h ^= h >> 16;
+	return h;
+}
+
+template <class T>
+struct NamedValue
+{
+	std::string_view name;
+	T value;
+};
+
+template <class T, int BITS, uint32_t SEED, size_t N>
+class PerfectHashTable
+{
+public:
+
+	static constexpr size_t SLOTS = size_t(1) << BITS;
+
+	constexpr PerfectHashTable(const NamedValue<T>(&list)[N])
+		: entries{}
+		, slots{}
+		, perfect(true)
+	{
+		for (size_t i = 0; i < SLOTS; i++)
+			slots[i] = -1;
+
+		for (size_t i = 0; i < N; i++)
+		{
+			entries[i] = list[i];
+
+			size_t slot = slotOf(list[i].name);
+			if (slots[slot] != -1)
+				perfect = false;
+			slots[slot] = static_cast<int16_t>(i);
+		}
+	}
+
+	constexpr const T* find(std::string_view name) const
+	{
+		int idx = slots[slotOf(name)];
+
+		if (idx < 0 || entries[idx].name != name)
+			return nullptr;
+
+		return &entries[idx].value;
+	}
+
+	constexpr bool is_perfect() const { return perfect; }
+	constexpr size_t size() const { return N; }
+	constexpr const NamedValue<T>& operator[](size_t i) const { return entries[i]; }
+
+private:
+
+	static constexpr size_t slotOf(std::string_view name)
+	{
+		return name_hash(name, SEED) >> (32 - BITS);
+	}
+
+	NamedValue<T> entries[N];
+	int16_t slots[SLOTS];
+	bool perfect;
+};
+
+template <class T, int BITS, uint32_t SEED, size_t N>
+constexpr PerfectHashTable<T, BITS, SEED, N> make_perfect_hash(const NamedValue<T>(&list)[N])
+{
+	return PerfectHashTable<T, BITS, SEED, N>(list);
+}
@@ -14,7 +14,39 @@ void Preprocessor::clear()
     while (!state_stack.empty()) state_stack.pop();
     blocks.clear();
     defines.clear();
+    symbols.clear();
+    define_by_symbol.clear();
+    macro_by_symbol.clear();
+    expansion_stack.clear();
+    errors.clear();
     preprocessed_code.clear();
+    sinks.clear();
+
+    include_cache.clear();
+    include_stack.clear();
+    include_hits = 0;
+    include_misses = 0;
+    include_skips = 0;
+    io_wait = 0;
+
+    recording.reset();
+    snapshot_hits = 0;
+    snapshot_misses = 0;
+    snapshot_writes = 0;
+
+    definition_generation = 0;
+    cache_generation = 0;
+    expansion_cache.clear();
+    cache_hits = 0;
+    cache_misses = 0;
+    expansion_errors = 0;
+
+    fork_names.clear();
+    fork_scans.clear();
+    fork_source.reset();
+    fork_line = 0;
+    fork_skip_depth = 0;
+    fork_result = false;
 }
 
 bool Preprocessor::is_ok() const
@@ -22,11 +54,34 @@ bool Preprocessor::is_ok() const
     return is_okay && state_stack.empty();
 }
 
+const ErrorLog& Preprocessor::diagnostics() const
+{
+    return errors;
+}
+
 Preprocessor::Preprocessor()
     : is_okay(false)
     , verbose(false)
     , line_num(0)
     , include_depth(0)
+    , shared_includes(nullptr)
+    , include_hits(0)
+    , include_misses(0)
+    , include_skips(0)
+    , prefetch(nullptr)
+    , io_wait(0)
+    , shared_snapshots(nullptr)
+    , snapshot_hits(0)
+    , snapshot_misses(0)
+    , snapshot_writes(0)
+    , definition_generation(0)
+    , cache_generation(0)
+    , cache_hits(0)
+    , cache_misses(0)
+    , expansion_errors(0)
+    , fork_line(0)
+    , fork_skip_depth(0)
+    , fork_result(false)
 {
 }
 
@@ -36,7 +91,7 @@ bool Preprocessor::pushState(const std::string& name, PreprocessorDirective type
     PREPROCESS_STATE state, bool skip_content)
 {
     if (state_stack.size() > MAX_INCLUDE_DEPTH) {
-        error_log.addError(ErrorLog::PREPROCESSOR_STACK_OVERFLOW, name, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_STACK_OVERFLOW, name, line_num);
         is_okay = false;
         return false;
     }
@@ -56,7 +111,7 @@ bool Preprocessor::pushState(const std::string& name, PreprocessorDirective type
 bool Preprocessor::popState()
 {
     if (state_stack.empty()) {
-        error_log.addError(ErrorLog::PREPROCESSOR_STACK_UNDERFLOW, "", line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_STACK_UNDERFLOW, "", line_num);
         is_okay = false;
         return false;
     }
@@ -101,102 +156,168 @@ bool Preprocessor::wasConditionMetInCurrentBlock() const
     return !state_stack.empty() && state_stack.top().condition_met;
 }
 
-bool Preprocessor::evaluateCondition(const std::string& condition) const
+bool Preprocessor::evaluateCondition(std::string_view condition) const
 {
     if (condition.empty()) return false;
 
-    try {
-        int value;
-        if (condition.find("0x") == 0 || condition.find("0X") == 0) {
-            value = std::stoi(condition, nullptr, 16);
-        }
-        else {
-            value = std::stoi(condition);
-        }
-        return (value != 0);
-    }
-    catch (const std::exception&) {
-        return !condition.empty();
+    Literal literal;
+    if (parse_literal(condition, literal)) {
+        return (literal.value != 0);
     }
+
+    // any other non-empty text counts as true
+    return true;
 }
 
-bool Preprocessor::isDefined(const std::string& macroName) const
+bool Preprocessor::isDefined(std::string_view macroName) const
 {
-    bool found = blocks.find(macroName) != blocks.end() ||
-        defines.find(macroName) != defines.end();
+    bool found = findMacro(macroName) != nullptr ||
+        findDefine(macroName) != nullptr;
 
-    qprintf(verbose, 4, "isDefined('%s') = %d", macroName.c_str(), found);
+    qprintf(verbose, 4, "isDefined('%.*s') = %d", (int)macroName.size(), macroName.data(), found);
     return found;
 }
 
-// ==================== HELPERS: TRIM / SPLIT ARGS ====================
+// ==================== MACRO EXPANSION ====================
 
-static std::string trim_copy(const std::string& s) { return trim(s); }
+static bool isWordChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
 
-static std::vector<std::string> split_args_by_comma(const std::string& s)
+const Preprocessor::Define* Preprocessor::findDefine(std::string_view name) const
 {
-    std::vector<std::string> out;
-    std::string tmp;
-    std::istringstream iss(s);
-    // manual parse to preserve tokens with spaces trimmed
-    size_t i = 0;
-    std::string cur;
-    while (i < s.size()) {
-        if (s[i] == ',') {
-            out.push_back(trim(cur));
-            cur.clear();
-            ++i;
-            continue;
-        }
-        cur.push_back(s[i++]);
-    }
-    if (!cur.empty()) out.push_back(trim(cur));
-    return out;
+    const Define* def = define_by_symbol.get(symbols.find(name));
+
+    if (recording)
+        recordDefineLookup(name, def);
+
+    return def;
 }
 
-static std::list<std::string> split_tokens_space(const std::string& s)
+const Preprocessor::MacroBlock* Preprocessor::findMacro(std::string_view name) const
 {
-    std::list<std::string> out;
-    std::istringstream iss(s);
-    std::string tok;
-    while (iss >> tok) out.push_back(tok);
-    return out;
+    const MacroBlock* block = macro_by_symbol.get(symbols.find(name));
+
+    if (recording)
+        recordMacroLookup(name, block);
+
+    return block;
 }
 
-// ==================== MACRO EXPANSION ====================
+// Map nodes do not move, so the indexes keep pointing at them
+void Preprocessor::storeDefine(Define def)
+{
+    Define& stored = defines[def.name];
+    stored = std::move(def);
+    define_by_symbol.set(symbols.intern(stored.name), &stored);
+}
 
-// expandMacros:   #define ()
-std::string Preprocessor::expandMacros(const std::string& line) const
+void Preprocessor::storeMacro(MacroBlock block)
 {
-    std::string result = line;
+    MacroBlock& stored = blocks[block.name];
+    stored = std::move(block);
+    macro_by_symbol.set(symbols.intern(stored.name), &stored);
+}
 
-    //  defines   (   )
-    for (auto it = defines.rbegin(); it != defines.rend(); ++it)
+// expandMacros: substitutes #define constants in one scan of the line.
+// Every word is looked up once; string and char literals are copied as is.
+// Define values are already expanded when defined, so no rescan is needed.
+std::string Preprocessor::expandMacros(std::string_view line) const
+{
+    if (defines.empty())
+        return std::string(line);
+
+    std::string result;
+    result.reserve(line.size());
+
+    size_t pos = 0;
+    while (pos < line.size())
     {
-        const auto& def = *it; // pair<const string, Define>
-        const std::string& name = def.first;
-        const std::string& value = def.second.value;
+        char c = line[pos];
+
+        if (c == '"' || c == '\'') {
+            size_t end = line.find(c, pos + 1);
+            end = (end == std::string_view::npos) ? line.size() : end + 1;
+            result.append(line.substr(pos, end - pos));
+            pos = end;
+            continue;
+        }
+
+        if (!isWordChar(c)) {
+            result.push_back(c);
+            pos++;
+            continue;
+        }
+
+        size_t start = pos;
+        while (pos < line.size() && isWordChar(line[pos]))
+            pos++;
+
+        std::string_view word = line.substr(start, pos - start);
+
+        // numbers (0x1F, 10h) are words too, but never names
+        const Define* def = (c >= '0' && c <= '9') ? nullptr : findDefine(word);
+        if (def)
+            result += def->value;
+        else
+            result.append(word);
+    }
+
+    return result;
+}
+
+// compileMacroBody: splits every body line into literal text and
+// whole-word argument references, so an invocation is plain concatenation
+void Preprocessor::compileMacroBody(MacroBlock& block)
+{
+    block.body.clear();
+    block.body.reserve(block.lines.size());
+
+    for (const auto& body_line : block.lines)
+    {
+        std::string_view line = body_line;
+        MacroLine compiled;
+        compiled.literal_size = 0;
+
+        std::string literal;
+
+        auto flushLiteral = [&]() {
+            if (literal.empty()) return;
+            compiled.literal_size += literal.size();
+            compiled.segments.push_back({ -1, std::move(literal) });
+            literal.clear();
+        };
 
         size_t pos = 0;
-        while ((pos = result.find(name, pos)) != std::string::npos)
+        while (pos < line.size())
         {
-            bool is_whole_word = true;
+            if (!isWordChar(line[pos])) {
+                literal.push_back(line[pos++]);
+                continue;
+            }
 
-            if (pos > 0 && (isalnum(result[pos - 1]) || result[pos - 1] == '_')) is_whole_word = false;
-            size_t after = pos + name.length();
-            if (after < result.length() && (isalnum(result[after]) || result[after] == '_')) is_whole_word = false;
+            size_t start = pos;
+            while (pos < line.size() && isWordChar(line[pos]))
+                pos++;
 
-            if (is_whole_word) {
-                result.replace(pos, name.length(), value);
-                pos += value.length();
-            }
-            else {
-                pos += name.length();
+            std::string_view word = line.substr(start, pos - start);
+
+            auto it = std::find(block.args.begin(), block.args.end(), word);
+            if (it == block.args.end()) {
+                literal.append(word);
+                continue;
             }
+
+            flushLiteral();
+            compiled.segments.push_back({ static_cast<int>(it - block.args.begin()), {} });
         }
+
+        flushLiteral();
+        block.body.push_back(std::move(compiled));
     }
 
-    return result;
+    block.lines.clear();
 }
 
 // expandMacroInvocation:        .
@@ -204,80 +325,91 @@ std::string Preprocessor::expandMacros(const std::string& line) const
 //   preprocessed_code.       ,
 //   const_cast.
 
-bool Preprocessor::expandMacroInvocation(const std::string& line) const
+bool Preprocessor::expandMacroInvocation(std::string_view line, const TokenList& tokens) const
 {
-    std::string trimmed = trim(line);
-    if (trimmed.empty()) return false;
+    if (tokens.empty()) return false;
 
     //       
-    std::istringstream iss(trimmed);
-    std::string first;
-    if (!(iss >> first)) return false;
-
     //       
-    auto itBlock = blocks.find(first);
-    if (itBlock == blocks.end()) return false;
+    const MacroBlock* found = findMacro(tokens[0].text);
+    if (!found) return false;
 
     //   .     ( )
-    std::string rest;
-    std::getline(iss, rest);
-    rest = trim(rest);
-
     //   :   
-    std::vector<std::string> call_args;
-    if (!rest.empty()) {
-        call_args = split_args_by_comma(rest);
-    }
-    else {
-        call_args = {};
+    Lexer lexer(line);
+    Token arg;
+    lexer.next(arg);
+
+    std::vector<std::string_view> call_args;
+    while (lexer.nextOperand(arg)) {
+        call_args.push_back(arg.text);
     }
 
-    const MacroBlock& block = itBlock->second;
+    const MacroBlock& block = *found;
     size_t expected_args = block.args.size();
 
     if (call_args.size() != expected_args) {
         //     ,   
-        error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_MACRO,
-            "Macro invocation with wrong args: " + trimmed, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_MACRO,
+            "Macro invocation with wrong args: " + std::string(line), line_num);
+        expansion_errors++;
         // ,      ;   false
         const_cast<Preprocessor*>(this)->is_okay = false;
         return false;
     }
 
-    //   Name->value
-    std::vector<std::string> param_names;
-    for (const auto& n : block.args) param_names.push_back(n);
-
-    std::map<std::string, std::string> param_map;
-    for (size_t i = 0; i < param_names.size(); ++i) {
-        param_map[param_names[i]] = call_args[i];
-    }
-
-    //       thread_local     
-    static thread_local std::vector<std::string> expansion_stack;
-
     //        
     if (std::find(expansion_stack.begin(), expansion_stack.end(), block.name) != expansion_stack.end()) {
-        error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_MACRO,
+        errors.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_MACRO,
             "Recursive macro expansion detected: " + block.name, line_num);
+        expansion_errors++;
         const_cast<Preprocessor*>(this)->is_okay = false;
         return false;
     }
 
+    if (cache_generation != definition_generation) {
+        expansion_cache.clear();
+        cache_generation = definition_generation;
+    }
+
+    std::string key = block.name;
+    for (const auto& a : call_args) {
+        key.push_back('\n');
+        key.append(a);
+    }
+
+    // a snapshot must see every lookup the expansion makes, so no shortcuts while recording
+    auto cached = recording ? expansion_cache.end() : expansion_cache.find(key);
+    if (cached != expansion_cache.end()) {
+        cache_hits++;
+        const_cast<std::string&>(preprocessed_code).append(cached->second);
+        return true;
+    }
+
+    cache_misses++;
+    size_t expansion_start = preprocessed_code.size();
+    int errors_before = expansion_errors;
+
     //   
     expansion_stack.push_back(block.name);
 
     //     -    (whole-word)     
-    for (const auto& body_line : block.lines) {
-        std::string substituted = body_line;
-
-        //     whole-word, 
-        for (const auto& p : param_map) {
-            const std::string& pname = p.first;
-            const std::string& pval = p.second;
-            //    
-            std::regex re("\\b" + std::regex_replace(pname, std::regex(R"([.^$|()\\[\]{}*+?])"), R"(\\$&)") + "\\b");
-            substituted = std::regex_replace(substituted, re, pval);
+    std::string substituted;
+
+    for (const auto& body_line : block.body) {
+        // Body is precompiled: literal segments and argument slots
+        size_t size = body_line.literal_size;
+        for (const auto& seg : body_line.segments)
+            if (seg.param >= 0) size += call_args[seg.param].size();
+
+        substituted.clear();
+        substituted.reserve(size);
+
+        for (const auto& seg : body_line.segments) {
+            if (seg.param >= 0)
+                substituted.append(call_args[seg.param]);
+            else
+                substituted.append(seg.text);
         }
 
         //    defines
@@ -285,7 +417,9 @@ bool Preprocessor::expandMacroInvocation(const std::string& line) const
 
         //   :      , expandMacroInvocation  .
         //  avoid infinite loops, expandMacroInvocation    expansion_stack.
-        bool nested_expanded = expandMacroInvocation(substituted);
+        TokenList nested_tokens;
+        tokenize(substituted, nested_tokens);
+        bool nested_expanded = expandMacroInvocation(substituted, nested_tokens);
         if (!nested_expanded) {
             //     (const_cast  - const )
             std::string* out = const_cast<std::string*>(&preprocessed_code);
@@ -297,19 +431,22 @@ bool Preprocessor::expandMacroInvocation(const std::string& line) const
     //   
     expansion_stack.pop_back();
 
+    if (expansion_errors == errors_before)
+        expansion_cache.emplace(std::move(key), preprocessed_code.substr(expansion_start));
+
     return true;
 }
 
 // ==================== PREPROCESSOR DIRECTIVES ====================
 
-bool Preprocessor::preprocessInclude(const std::string& line)
+bool Preprocessor::preprocessInclude(std::string_view line)
 {
-    qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
+    qprintf(verbose, 3, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
     include_depth++;
 
     if (include_depth > MAX_INCLUDE_DEPTH) {
-        error_log.addError(ErrorLog::PREPROCESSOR_INCLUDE_DEPTH_EXCEEDED, "", line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_INCLUDE_DEPTH_EXCEEDED, "", line_num);
         is_okay = false;
         include_depth--;
         return false;
@@ -317,27 +454,55 @@ bool Preprocessor::preprocessInclude(const std::string& line)
 
     std::string filename = parse_include(line);
     if (filename.empty()) {
-        error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
         is_okay = false;
         include_depth--;
         return false;
     }
 
-    std::string source_code;
-    if (!readFile(filename, source_code, verbose)) {
-        error_log.addError(ErrorLog::FILE_CANNOT_OPEN, filename, line_num);
+    IncludeFile* file = loadInclude(filename);
+    if (!file) {
+        errors.addError(ErrorLog::FILE_CANNOT_OPEN, filename, line_num);
         is_okay = false;
         include_depth--;
         return false;
     }
 
+    // Nothing in the file can take effect - do not even scan it
+    if (file->once || (!file->guard.empty() && isDefined(file->guard))) {
+        qprintf(verbose, 2, "INCLUDE SKIPPED: %s", filename.c_str());
+        include_skips++;
+        include_depth--;
+        return true;
+    }
+
     //   line_num      ,
     //        .
     int saved_line_num = line_num;
     line_num = 1;
 
-    auto lines = split_text_to_lines(source_code, true);
-    bool result = prep_pass(lines);
+    bool record = false;
+    if ((!snapshot_dir.empty() || shared_snapshots) && !recording) {
+        if (loadSnapshot(*file)) {
+            line_num = saved_line_num;
+            include_depth--;
+            return true;
+        }
+
+        beginSnapshot(*file);
+        record = true;
+    }
+
+    file->active++;
+    include_stack.push_back(file);
+
+    bool result = prep_pass(*file->source);
+
+    include_stack.pop_back();
+    file->active--;
+
+    if (record)
+        endSnapshot(result);
 
     //   line_num.  line_num  saved_line_num:
     line_num = saved_line_num;
@@ -349,35 +514,194 @@ bool Preprocessor::preprocessInclude(const std::string& line)
     return result;
 }
 
-bool Preprocessor::preprocessDefine(const std::string& line)
+void Preprocessor::setSharedIncludes(SharedIncludes* shared)
 {
-    qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
+    shared_includes = shared;
+}
+
+void Preprocessor::setPrefetch(IncludePrefetch* prefetch)
+{
+    this->prefetch = prefetch;
+}
+
+Preprocessor::IncludeFile* Preprocessor::loadInclude(const std::string& filename)
+{
+    std::error_code ec;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(filename, ec);
+    std::string key = ec ? filename : canonical.string();
+
+    auto mtime = std::filesystem::last_write_time(key, ec);
+
+    if (recording && std::find(recording->files.begin(), recording->files.end(), key) == recording->files.end())
+        recording->files.push_back(key);
+
+    auto it = include_cache.find(key);
+    if (it != include_cache.end()) {
+        // a file being processed is never reloaded under its own lines
+        if (it->second.active || (!ec && it->second.mtime == mtime)) {
+            include_hits++;
+            return &it->second;
+        }
+    }
+
+    SharedIncludes::File contents;
+
+    if (shared_includes && !ec && shared_includes->find(key, mtime, contents)) {
+        include_hits++;
+    }
+    else {
+        std::shared_ptr<const SourceText> source;
+        std::string source_code;
+
+        // the wait for a file, read ahead or not, is the I/O on this thread's path
+        auto io_start = std::chrono::steady_clock::now();
+        bool prefetched = prefetch && !ec && prefetch->source(filename, mtime, source);
+        bool read = prefetched || readFile(filename, source_code, errors, verbose);
+        io_wait += std::chrono::duration<double>(std::chrono::steady_clock::now() - io_start).count();
+
+        if (!read)
+            return nullptr;
+
+        include_misses++;
+
+        if (prefetched)
+            qprintf(verbose, 0, "Prefetched file: %s", filename.c_str());
+        else
+            source = std::make_shared<SourceText>(std::move(source_code));
+        contents.mtime = mtime;
+        contents.guard = detectIncludeGuard(*source);
+        contents.source = std::move(source);
+
+        if (shared_includes && !ec)
+            shared_includes->add(key, contents);
+    }
+
+    IncludeFile& file = include_cache[key];
+    file.path = key;
+    file.mtime = mtime;
+    file.source = contents.source;
+    file.guard = contents.guard;
+    file.once = false;
+    file.active = 0;
+    file.hashed = false;
+    file.hash = 0;
+
+    if (!file.guard.empty())
+        qprintf(verbose, 2, "INCLUDE GUARD: %s in %s", file.guard.c_str(), key.c_str());
+
+    return &file;
+}
+
+// Recognizes the classic guard wrapping the whole file:
+//   #ifndef X / #define X / ... / #endif
+std::string Preprocessor::detectIncludeGuard(const SourceText& source)
+{
+    TokenList tokens;
+    PreprocessorDirective type;
+
+    size_t first = 0;
+    size_t last = source.size();
+
+    while (first < last && source[first].empty()) first++;
+    while (last > first && source[last - 1].empty()) last--;
+
+    if (last - first < 3)
+        return {};
+
+    tokenize(source[first], tokens);
+    if (!isPreprocessDirective(tokens, type) || type != PREP_IFNDEF)
+        return {};
+
+    std::string_view guard = extract_macro_name(tokens);
+    if (guard.empty())
+        return {};
+
+    size_t second = first + 1;
+    while (source[second].empty()) second++;
+
+    tokenize(source[second], tokens);
+    if (!isPreprocessDirective(tokens, type) || type != PREP_DEFINE || extract_macro_name(tokens) != guard)
+        return {};
+
+    tokenize(source[last - 1], tokens);
+    if (!isPreprocessDirective(tokens, type) || type != PREP_ENDIF)
+        return {};
+
+    // the opening #ifndef must be closed by the last line, with no #else branch
+    int depth = 0;
+    for (size_t i = second + 1; i < last - 1; i++)
+    {
+        std::string_view line = source[i];
+        if (line.empty() || line[0] != '#' || !peekPreprocessDirective(line, type))
+            continue;
+
+        switch (type)
+        {
+        case PREP_IFDEF:
+        case PREP_IFNDEF:
+            depth++;
+            break;
+        case PREP_ENDIF:
+            if (--depth < 0)
+                return {};
+            break;
+        case PREP_ELSE:
+        case PREP_ELIFDEF:
+        case PREP_ELIFNDEF:
+            if (depth == 0)
+                return {};
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (depth != 0)
+        return {};
+
+    return std::string(guard);
+}
+
+bool Preprocessor::preprocessOnce(std::string_view line)
+{
+    qprintf(verbose, 3, "%s\n%.*s", __func__, (int)line.size(), line.data());
+
+    // #once in the top level file has nothing to guard
+    if (!include_stack.empty())
+        include_stack.back()->once = true;
+
+    return true;
+}
+
+bool Preprocessor::preprocessDefine(std::string_view line)
+{
+    qprintf(verbose, 3, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
     if (line.empty()) {
-        error_log.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME, line, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME, line, line_num);
         is_okay = false;
         return false;
     }
 
-    std::list<std::string> tokens = parse_define(line);
-    if (tokens.empty()) {
-        error_log.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME, line, line_num);
+    std::string_view name_view;
+    std::string value;
+    if (!parse_define(line, name_view, value)) {
+        errors.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME, line, line_num);
         is_okay = false;
         return false;
     }
 
-    std::string name = tokens.front();
-    tokens.pop_front();
+    std::string name(name_view);
 
     if (!isValidIdentifier(name)) {
-        error_log.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME,
+        errors.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME,
             "Invalid macro name: " + name, line_num);
         is_okay = false;
         return false;
     }
 
-    if (blocks.find(name) != blocks.end() || defines.find(name) != defines.end()) {
-        error_log.addError(ErrorLog::ASSEMBLER_MULTIPLE_DEFINITIONS, name, line_num);
+    if (findMacro(name) || findDefine(name)) {
+        errors.addError(ErrorLog::ASSEMBLER_MULTIPLE_DEFINITIONS, name, line_num);
         is_okay = false;
         return false;
     }
@@ -385,31 +709,68 @@ bool Preprocessor::preprocessDefine(const std::string& line)
     Define def;
     def.start_line = line_num;
     def.name = name;
+    def.value = expandMacros(value);
 
-    if (!tokens.empty()) {
-        std::ostringstream oss;
-        for (auto it = tokens.begin(); it != tokens.end(); ++it) {
-            if (it != tokens.begin()) oss << " ";
-            oss << *it;
-        }
-        def.value = oss.str();
-    }
-    else {
-        def.value = "";
-    }
+    storeDefine(def);
+    definition_generation++;
 
-    defines[name] = def;
+    if (recording) {
+        recording->seen.insert("d:" + name);
+        recording->defines.push_back(name);
+    }
     qprintf(verbose, 2, "DEFINE: %s = %s", name.c_str(), def.value.c_str());
 
     return true;
 }
 
-bool Preprocessor::preprocessElse(const std::string& line)
+void Preprocessor::define(const std::string& name, const std::string& value)
+{
+    predefined.emplace_back(name, value);
+}
+
+// define() names go in before the first line. Their values are taken as is,
+// so they do not depend on where in the source they are added
+bool Preprocessor::applyPredefined()
 {
-    qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
+    bool result = true;
+
+    for (const auto& [name, value] : predefined)
+    {
+        if (!isValidIdentifier(name)) {
+            errors.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME, "Invalid macro name: " + name, -1);
+            result = false;
+            continue;
+        }
+
+        if (findMacro(name) || findDefine(name)) {
+            errors.addError(ErrorLog::ASSEMBLER_MULTIPLE_DEFINITIONS, name, -1);
+            result = false;
+            continue;
+        }
+
+        Define def;
+        def.start_line = 0;
+        def.name = name;
+        def.value = value;
+
+        storeDefine(std::move(def));
+        qprintf(verbose, 2, "DEFINE: %s = %s", name.c_str(), value.c_str());
+    }
+
+    if (!predefined.empty())
+        definition_generation++;
+    if (!result)
+        is_okay = false;
+
+    return result;
+}
+
+bool Preprocessor::preprocessElse(std::string_view line)
+{
+    qprintf(verbose, 3, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
     if (state_stack.empty()) {
-        error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
         is_okay = false;
         return false;
     }
@@ -418,7 +779,7 @@ bool Preprocessor::preprocessElse(const std::string& line)
 
     if (current.type != PREP_IFDEF && current.type != PREP_IFNDEF &&
         current.type != PREP_ELIFDEF && current.type != PREP_ELIFNDEF) {
-        error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
         is_okay = false;
         return false;
     }
@@ -436,12 +797,12 @@ bool Preprocessor::preprocessElse(const std::string& line)
     return true;
 }
 
-bool Preprocessor::preprocessElifdef(const std::string& line)
+bool Preprocessor::preprocessElifdef(std::string_view line, const TokenList& tokens)
 {
-    qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
+    qprintf(verbose, 3, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
     if (state_stack.empty()) {
-        error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
         is_okay = false;
         return false;
     }
@@ -450,7 +811,7 @@ bool Preprocessor::preprocessElifdef(const std::string& line)
 
     if (current.type != PREP_IFDEF && current.type != PREP_IFNDEF &&
         current.type != PREP_ELIFDEF && current.type != PREP_ELIFNDEF) {
-        error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
         is_okay = false;
         return false;
     }
@@ -460,7 +821,7 @@ bool Preprocessor::preprocessElifdef(const std::string& line)
         current.state = STATE_WAITING_NEXT_CONDITION_BLOCK;
     }
     else {
-        std::string macroName = extract_macro_name(line);
+        std::string_view macroName = extract_macro_name(tokens);
         bool condition = isDefined(macroName);
 
         if (condition) {
@@ -477,12 +838,12 @@ bool Preprocessor::preprocessElifdef(const std::string& line)
     return true;
 }
 
-bool Preprocessor::preprocessElifndef(const std::string& line)
+bool Preprocessor::preprocessElifndef(std::string_view line, const TokenList& tokens)
 {
-    qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
+    qprintf(verbose, 3, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
     if (state_stack.empty()) {
-        error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
         is_okay = false;
         return false;
     }
@@ -491,7 +852,7 @@ bool Preprocessor::preprocessElifndef(const std::string& line)
 
     if (current.type != PREP_IFDEF && current.type != PREP_IFNDEF &&
         current.type != PREP_ELIFDEF && current.type != PREP_ELIFNDEF) {
-        error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
         is_okay = false;
         return false;
     }
@@ -501,7 +862,7 @@ bool Preprocessor::preprocessElifndef(const std::string& line)
         current.state = STATE_WAITING_NEXT_CONDITION_BLOCK;
     }
     else {
-        std::string macroName = extract_macro_name(line);
+        std::string_view macroName = extract_macro_name(tokens);
         bool condition = !isDefined(macroName);
 
         if (condition) {
@@ -518,20 +879,20 @@ bool Preprocessor::preprocessElifndef(const std::string& line)
     return true;
 }
 
-bool Preprocessor::preprocessIfdef(const std::string& line)
+bool Preprocessor::preprocessIfdef(std::string_view line, const TokenList& tokens)
 {
-    qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
+    qprintf(verbose, 3, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
-    std::string macroName = extract_macro_name(line);
+    std::string_view macroName = extract_macro_name(tokens);
     if (macroName.empty() || !isValidIdentifier(macroName)) {
-        error_log.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME, line, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME, line, line_num);
         is_okay = false;
         return false;
     }
 
     bool condition = isDefined(macroName);
 
-    qprintf(verbose, 2, "IFDEF '%s': condition = %d", macroName.c_str(), condition);
+    qprintf(verbose, 2, "IFDEF '%.*s': condition = %d", (int)macroName.size(), macroName.data(), condition);
 
     if (condition) {
         pushState("ifdef", PREP_IFDEF, STATE_READING_CONDITION_BLOCK, false);
@@ -543,20 +904,20 @@ bool Preprocessor::preprocessIfdef(const std::string& line)
     return true;
 }
 
-bool Preprocessor::preprocessIfndef(const std::string& line)
+bool Preprocessor::preprocessIfndef(std::string_view line, const TokenList& tokens)
 {
-    qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
+    qprintf(verbose, 3, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
-    std::string macroName = extract_macro_name(line);
+    std::string_view macroName = extract_macro_name(tokens);
     if (macroName.empty() || !isValidIdentifier(macroName)) {
-        error_log.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME, line, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME, line, line_num);
         is_okay = false;
         return false;
     }
 
     bool condition = !isDefined(macroName);
 
-    qprintf(verbose, 2, "IFNDEF '%s': condition = %d", macroName.c_str(), condition);
+    qprintf(verbose, 2, "IFNDEF '%.*s': condition = %d", (int)macroName.size(), macroName.data(), condition);
 
     if (condition) {
         pushState("ifndef", PREP_IFNDEF, STATE_READING_CONDITION_BLOCK, false);
@@ -568,12 +929,12 @@ bool Preprocessor::preprocessIfndef(const std::string& line)
     return true;
 }
 
-bool Preprocessor::preprocessEndif(const std::string& line)
+bool Preprocessor::preprocessEndif(std::string_view line)
 {
-    qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
+    qprintf(verbose, 3, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
     if (state_stack.empty()) {
-        error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
         is_okay = false;
         return false;
     }
@@ -581,45 +942,32 @@ bool Preprocessor::preprocessEndif(const std::string& line)
     return popState();
 }
 
-bool Preprocessor::preprocessMacro(const std::string& line)
+bool Preprocessor::preprocessMacro(std::string_view line)
 {
-    qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
-
-    //     
-    auto tokens = parse_macro_definition(line.substr(1)); //  #
-    if (tokens.empty()) {
-        error_log.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME, line, line_num);
-        is_okay = false;
-        return false;
-    }
+    qprintf(verbose, 3, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
-    // tokens: ["macro", "NAME", "arg1", "arg2", ...] -   
-    if (tokens.size() < 2) {
-        error_log.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME, line, line_num);
-        is_okay = false;
-        return false;
-    }
+    // #macro NAME arg1, arg2, ...
+    Lexer lexer(line);
+    Token tok;
 
-    std::string macroName = tokens.front(); // "macro"
-    tokens.pop_front();
+    lexer.next(tok); // #macro
 
-    if (tokens.empty()) {
-        error_log.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME, line, line_num);
+    if (!lexer.next(tok)) {
+        errors.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME, line, line_num);
         is_okay = false;
         return false;
     }
 
-    std::string name = tokens.front();
-    tokens.pop_front();
+    std::string name(tok.text);
 
     if (name.empty() || !isValidIdentifier(name)) {
-        error_log.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME, line, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_DEFINITION_WITHOUT_NAME, line, line_num);
         is_okay = false;
         return false;
     }
 
-    if (blocks.find(name) != blocks.end() || defines.find(name) != defines.end()) {
-        error_log.addError(ErrorLog::ASSEMBLER_MULTIPLE_DEFINITIONS, name, line_num);
+    if (findMacro(name) || findDefine(name)) {
+        errors.addError(ErrorLog::ASSEMBLER_MULTIPLE_DEFINITIONS, name, line_num);
         is_okay = false;
         return false;
     }
@@ -631,27 +979,37 @@ bool Preprocessor::preprocessMacro(const std::string& line)
     block.type = PREP_MACRO;
 
     //    
-    for (const auto& a : tokens) {
+    while (lexer.next(tok)) {
+        if (tok.kind == TOKEN_COMMA)
+            continue;
+
+        std::string a(tok.text);
         if (!isValidIdentifier(a)) {
-            error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_MACRO,
+            errors.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_MACRO,
                 "Invalid macro argument: '" + a + "'", line_num);
             is_okay = false;
         }
         block.args.push_back(a);
     }
 
-    blocks[name] = block;
+    storeMacro(block);
+    definition_generation++;
+
+    if (recording) {
+        recording->seen.insert("m:" + name);
+        recording->macros.push_back(name);
+    }
 
     // Enter macro reading state
     return pushState(name, PREP_MACRO, STATE_READING_MACRO, false);
 }
 
-bool Preprocessor::preprocessEndMacro(const std::string& line)
+bool Preprocessor::preprocessEndMacro(std::string_view line)
 {
-    qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
+    qprintf(verbose, 3, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
     if (state_stack.empty() || state_stack.top().type != PREP_MACRO) {
-        error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
         is_okay = false;
         return false;
     }
@@ -659,9 +1017,9 @@ bool Preprocessor::preprocessEndMacro(const std::string& line)
     return popState();
 }
 
-bool Preprocessor::preprocessReadingDefinition(const std::string& line)
+bool Preprocessor::preprocessReadingDefinition(std::string_view line, const TokenList& tokens)
 {
-    qprintf(verbose, 3, "%s\n%s", __func__, line.c_str());
+    qprintf(verbose, 3, "%s\n%.*s", __func__, (int)line.size(), line.data());
 
     if (state_stack.empty()) {
         return false;
@@ -671,23 +1029,25 @@ bool Preprocessor::preprocessReadingDefinition(const std::string& line)
     std::string macroName = current.name;
 
     // Check if this is #endmacro directive
-    if (isPreprocessDirective(line)) {
-        std::string directive = get_preprocessor_directive(line);
-        if (directive == "endmacro") {
-            qprintf(verbose, 3, "Found #endmacro for macro '%s' - ending macro definition", macroName.c_str());
-            // Pop state    
-            return popState();
-        }
+    PreprocessorDirective directive;
+    if (isPreprocessDirective(tokens, directive) && directive == PREP_ENDMACRO) {
+        qprintf(verbose, 3, "Found #endmacro for macro '%s' - ending macro definition", macroName.c_str());
+        auto it = blocks.find(macroName);
+        if (it != blocks.end())
+            compileMacroBody(it->second);
+
+        // Pop state    
+        return popState();
     }
 
     // Regular line - add to macro body
     auto it = blocks.find(macroName);
     if (it != blocks.end()) {
-        it->second.lines.push_back(line);
+        it->second.lines.emplace_back(line);
     }
     else {
         //     ,  
-        error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_MACRO, "Unknown macro while reading body: " + macroName, line_num);
+        errors.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_MACRO, "Unknown macro while reading body: " + macroName, line_num);
         is_okay = false;
     }
 
@@ -696,56 +1056,34 @@ bool Preprocessor::preprocessReadingDefinition(const std::string& line)
 
 // ==================== MAIN PROCESSING LOGIC ====================
 
-bool Preprocessor::process_line(const std::string& line)
+bool Preprocessor::process_line(std::string_view line)
 {
     bool success = true;
 
-    if (isPreprocessDirective(line))
+    TokenList tokens;
+    PreprocessorDirective type;
+
+    tokenize(line, tokens);
+
+    if (isPreprocessDirective(tokens, type))
     {
         if (isInMacroDefinition())
         {
             //      #endmacro   ,
             //      .
-            std::string directive = get_preprocessor_directive(line);
-            if (directive == "endmacro") {
-                preprocessReadingDefinition(line);
-            }
-            else {
-                preprocessReadingDefinition(line);
-            }
+            preprocessReadingDefinition(line, tokens);
             line_num++;
             return true; // 
         }
 
         if (shouldSkipCurrentBlock()) {
-            std::string directive = get_preprocessor_directive(line);
-            if (directive != "else" && directive != "endif" &&
-                directive != "elifdef" && directive != "elifndef") {
+            if (type != PREP_ELSE && type != PREP_ENDIF &&
+                type != PREP_ELIFDEF && type != PREP_ELIFNDEF) {
                 line_num++;
                 return true;
             }
         }
 
-        auto tokens = parse_preprocess_directive(line.substr(1));
-        if (tokens.empty()) {
-            error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
-            is_okay = false;
-            line_num++;
-            return false;
-        }
-
-        std::string directive_name = tokens.front();
-        auto it = PREPROCESSOR_DIRECTIVES.find(directive_name);
-        if (it == PREPROCESSOR_DIRECTIVES.end()) {
-            error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
-            is_okay = false;
-            line_num++;
-            return false;
-        }
-
-        PreprocessorDirective type = it->second;
-        tokens.pop_front();
-
         switch (type)
         {
         case PREP_INCLUDE:
@@ -758,16 +1096,16 @@ bool Preprocessor::process_line(const std::string& line)
             success = preprocessElse(line);
             break;
         case PREP_ELIFDEF:
-            success = preprocessElifdef(line);
+            success = preprocessElifdef(line, tokens);
             break;
         case PREP_ELIFNDEF:
-            success = preprocessElifndef(line);
+            success = preprocessElifndef(line, tokens);
             break;
         case PREP_IFDEF:
-            success = preprocessIfdef(line);
+            success = preprocessIfdef(line, tokens);
             break;
         case PREP_IFNDEF:
-            success = preprocessIfndef(line);
+            success = preprocessIfndef(line, tokens);
             break;
         case PREP_ENDIF:
             success = preprocessEndif(line);
@@ -775,12 +1113,15 @@ bool Preprocessor::process_line(const std::string& line)
         case PREP_MACRO:
             success = preprocessMacro(line);
             break;
+        case PREP_ONCE:
+            success = preprocessOnce(line);
+            break;
         case PREP_ENDMACRO:
             //      ,  
             success = preprocessEndMacro(line);
             break;
         default:
-            error_log.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
+            errors.addError(ErrorLog::PREPROCESSOR_UNEXCEPTED_DIRECTIVE, line, line_num);
             is_okay = false;
             success = false;
             break;
@@ -798,17 +1139,17 @@ bool Preprocessor::process_line(const std::string& line)
         {
         case STATE_FETCHING:
             //      (one-pass)
-            if (!expandMacroInvocation(line)) {
+            if (!expandMacroInvocation(line, tokens)) {
                 preprocessed_code += expandMacros(line) + '\n';
             }
             break;
         case STATE_READING_MACRO:
-            preprocessReadingDefinition(line);
+            preprocessReadingDefinition(line, tokens);
             break;
         case STATE_READING_CONDITION_BLOCK:
             if (!t.skip_content)
             {
-                if (!expandMacroInvocation(line)) {
+                if (!expandMacroInvocation(line, tokens)) {
                     preprocessed_code += expandMacros(line) + '\n';
                 }
             }
@@ -824,7 +1165,7 @@ bool Preprocessor::process_line(const std::string& line)
     else
     {
         // No active states - expand macros
-        if (!expandMacroInvocation(line)) {
+        if (!expandMacroInvocation(line, tokens)) {
             preprocessed_code += expandMacros(line) + '\n';
         }
     }
@@ -833,58 +1174,257 @@ bool Preprocessor::process_line(const std::string& line)
     return true;
 }
 
-bool Preprocessor::prep_pass(const std::list<std::string>& lines)
+bool Preprocessor::prep_pass(const SourceText& lines)
 {
     qprintf(verbose, 2, "%s", __func__);
 
     if (lines.empty()) return false;
 
-    bool overall_ok = true;
     line_num = 1;
-    for (const auto& line : lines)
+    int skip_depth = 0;
+    return passLines(lines, skip_depth);
+}
+
+// Lines of a file or of one block of it. skip_depth carries the nesting of
+// an inactive region that goes on past the end of the block
+bool Preprocessor::passLines(const SourceText& lines, int& skip_depth, size_t first)
+{
+    bool overall_ok = true;
+    for (size_t i = first; i < lines.size(); i++)
     {
+        // Inactive region - jump straight to the directive that can end it
+        if (shouldSkipCurrentBlock()) {
+            size_t next = skipInactiveRegion(lines, i, skip_depth);
+            line_num += static_cast<int>(next - i);
+            i = next;
+
+            if (i == lines.size())
+                break;
+        }
+
+        std::string_view line = lines[i];
+
         if (line.empty()) {
             line_num++;
             continue;
         }
 
+        // prefix run - the configurations can differ from this main file line on
+        if (include_depth == 0 && fork_names.size() && forkStartsAt(line)) {
+            fork_line = i;
+            fork_skip_depth = skip_depth;
+            break;
+        }
+
         if (!process_line(line))
             overall_ok = false;
+
+        // between lines no expansion holds an offset into the output
+        if (preprocessed_code.size() >= OUTPUT_BLOCK_SIZE)
+            flushOutput();
         //      ; is_okay    
     }
 
     return overall_ok;
 }
 
-std::string Preprocessor::preprocess(const std::string& source, bool verbose)
+// Index of the first line at nesting depth 0 that can change the state of
+// the skipped block (#else, #elifdef, #elifndef, #endif), lines.size() if none.
+// Only lines starting with '#' are looked at, nested blocks are only counted
+// in depth, which stays above zero when the region goes on past the last line.
+size_t Preprocessor::skipInactiveRegion(const SourceText& lines, size_t first, int& depth) const
+{
+    for (size_t i = first; i < lines.size(); i++)
+    {
+        std::string_view line = lines[i];
+        PreprocessorDirective type;
+
+        if (line.empty() || line[0] != '#' || !peekPreprocessDirective(line, type))
+            continue;
+
+        switch (type)
+        {
+        case PREP_IFDEF:
+        case PREP_IFNDEF:
+            depth++;
+            break;
+        case PREP_ENDIF:
+            if (depth == 0)
+                return i;
+            depth--;
+            break;
+        case PREP_ELSE:
+        case PREP_ELIFDEF:
+        case PREP_ELIFNDEF:
+            if (depth == 0)
+                return i;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return lines.size();
+}
+
+void Preprocessor::flushOutput()
+{
+    // a header being snapshotted keeps its part of the output
+    if (recording)
+    {
+        recording->code.append(preprocessed_code, recording->code_start, std::string::npos);
+        recording->code_start = 0;
+    }
+
+    for (auto* sink : sinks)
+        sink->write(preprocessed_code);
+
+    preprocessed_code.clear();
+}
+
+std::string Preprocessor::preprocess(std::string source, bool verbose)
+{
+    StringSink output;
+
+    if (!preprocess(std::move(source), { &output }, verbose))
+        return {};
+
+    return std::move(output.text);
+}
+
+bool Preprocessor::preprocess(std::string source, const std::vector<TextSink*>& sinks, bool verbose)
 {
     qprintf(verbose, 1, "%s", __func__);
 
     clear();
     this->verbose = verbose;
+    this->sinks = sinks;
 
-    const std::list<std::string> lines = split_text_to_lines(source, true);
+    const SourceText lines(std::move(source));
+    if (prefetch)
+        prefetch->scan(lines);
 
-    if (!prep_pass(lines))
+    bool predefined_ok = applyPredefined();
+    bool result = prep_pass(lines);
+
+    return finishPreprocess(result && predefined_ok);
+}
+
+// Next block of whole lines, about READ_BLOCK_SIZE long. The partial last
+// line waits in carry for the next call. False when the stream is exhausted
+static bool readLineBlock(std::istream& in, std::string& carry, std::string& block)
+{
+    static const size_t READ_BLOCK_SIZE = 1024 * 1024;
+
+    block = std::move(carry);
+    carry.clear();
+
+    while (in)
     {
-        qprintf(verbose, 0, "PREPROCESS FAILED - errors: %d", error_log.has_errors());
-        return {};
+        size_t old_size = block.size();
+        block.resize(old_size + READ_BLOCK_SIZE);
+        in.read(&block[old_size], READ_BLOCK_SIZE);
+        block.resize(old_size + static_cast<size_t>(in.gcount()));
+
+        size_t end = block.rfind('\n');
+        if (end != std::string::npos)
+        {
+            if (in)
+            {
+                carry.assign(block, end + 1, std::string::npos);
+                block.resize(end + 1);
+            }
+            return true;
+        }
+    }
+
+    return !block.empty();
+}
+
+bool Preprocessor::preprocessFile(const std::string& filename, const std::vector<TextSink*>& sinks, bool verbose)
+{
+    qprintf(verbose, 1, "%s\n%s", __func__, filename.c_str());
+
+    clear();
+    this->verbose = verbose;
+    this->sinks = sinks;
+
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        errors.addError(ErrorLog::FILE_CANNOT_OPEN, filename, -1);
+        return finishPreprocess(false);
+    }
+
+    SourceText lines;
+    std::string block;
+    std::string carry;
+
+    bool result = applyPredefined();
+    bool empty = true;
+    int skip_depth = 0;
+    line_num = 1;
+
+    while (readLineBlock(file, carry, block))
+    {
+        lines.assign(std::move(block));
+        block.clear();
+
+        if (prefetch)
+            prefetch->scan(lines);
+
+        if (!lines.empty())
+            empty = false;
+
+        if (!passLines(lines, skip_depth))
+            result = false;
+    }
+
+    // an empty source fails like it does in prep_pass()
+    return finishPreprocess(result && !empty);
+}
+
+bool Preprocessor::finishPreprocess(bool result)
+{
+    auto fail = [&]() {
+        for (auto* sink : sinks)
+            sink->close(false);
+        sinks.clear();
+        preprocessed_code.clear();
+        return false;
+    };
+
+    if (!result)
+    {
+        qprintf(verbose, 0, "PREPROCESS FAILED - errors: %d", errors.has_errors());
+        return fail();
     }
 
     if (!state_stack.empty())
     {
-        error_log.addError(ErrorLog::PREPROCESSOR_UNCLOSED_BLOCK, state_stack.top().name, line_num);
-        qprintf(verbose, 0, "UNCLOSED BLOCK - errors: %d", error_log.has_errors());
+        errors.addError(ErrorLog::PREPROCESSOR_UNCLOSED_BLOCK, state_stack.top().name, line_num);
+        qprintf(verbose, 0, "UNCLOSED BLOCK - errors: %d", errors.has_errors());
         is_okay = false;
-        return {};
+        return fail();
     }
 
-    is_okay = !error_log.has_errors();
+    is_okay = !errors.has_errors();
     
-    qprintf(verbose, 1, "PREPROCESS END - errors: %d\n", error_log.has_errors());
+    qprintf(verbose, 1, "INCLUDE CACHE: %zu hits, %zu misses, %zu skipped", include_hits, include_misses, include_skips);
+    qprintf(verbose, 1, "INCLUDE I/O: %.2f ms waiting for files", io_wait * 1000);
+    qprintf(verbose, 1, "MACRO CACHE: %zu hits, %zu misses", cache_hits, cache_misses);
+    if (!snapshot_dir.empty())
+        qprintf(verbose, 1, "SNAPSHOTS: %zu hits, %zu misses, %zu written", snapshot_hits, snapshot_misses, snapshot_writes);
+    qprintf(verbose, 1, "PREPROCESS END - errors: %d\n", errors.has_errors());
 
     if (!is_okay) 
-        return {};
+        return fail();
+
+    flushOutput();
 
-    return preprocessed_code;
+    for (auto* sink : sinks)
+        sink->close(true);
+    sinks.clear();
+
+    return true;
 }
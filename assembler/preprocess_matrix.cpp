@@ -0,0 +1,195 @@
+#include "preprocessor.h"
+#include "utils.h"
+
+/*
+    Configuration matrix - one source preprocessed under several sets of defines.
+
+    Up to the first line that names a define the sets disagree on, every set
+    emits the same text and builds the same state, so those lines run once.
+    An #include counts as naming it when the file or anything it includes
+    does. The prefix stops on the main file only, where the state is the
+    maps and the condition stack, and every set goes on from there in its
+    own copy. Lines are trimmed and stripped of comments, so a name in a
+    comment does not end the prefix; one in a string or an inactive branch
+    does, which only makes the prefix shorter.
+*/
+
+static bool isWordChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+bool Preprocessor::preprocessPrefix(std::string source, const std::vector<std::string>& names,
+    const std::vector<TextSink*>& sinks, bool verbose)
+{
+    qprintf(verbose, 1, "%s", __func__);
+
+    clear();
+    this->verbose = verbose;
+    this->sinks = sinks;
+
+    for (const auto& name : names)
+        fork_names.intern(name);
+
+    auto lines = std::make_shared<SourceText>(std::move(source));
+    fork_source = lines;
+    if (prefetch)
+        prefetch->scan(*lines);
+    fork_line = lines->size();
+
+    bool predefined_ok = applyPredefined();
+    bool result = prep_pass(*lines);
+
+    fork_result = result && predefined_ok;
+
+    // the forks start with nothing pending, the sinks are theirs to close
+    flushOutput();
+    this->sinks.clear();
+
+    qprintf(verbose, 1, "PREFIX: %zu of %zu lines, %zu fork names", fork_line, lines->size(), fork_names.size());
+
+    return fork_result;
+}
+
+bool Preprocessor::preprocessFork(const Preprocessor& base, const std::vector<TextSink*>& sinks, bool verbose)
+{
+    qprintf(verbose, 1, "%s", __func__);
+
+    clear();
+    this->verbose = verbose;
+    this->sinks = sinks;
+
+    copyState(base);
+
+    bool predefined_ok = applyPredefined();
+    int skip_depth = base.fork_skip_depth;
+    bool result = passLines(*base.fork_source, skip_depth, base.fork_line);
+
+    return finishPreprocess(base.fork_result && predefined_ok && result);
+}
+
+bool Preprocessor::forkStartsAt(std::string_view line)
+{
+    if (namesForkName(line))
+        return true;
+
+    PreprocessorDirective type;
+    if (!peekPreprocessDirective(line, type) || type != PREP_INCLUDE)
+        return false;
+
+    std::string filename = parse_include(line);
+    std::unordered_set<std::string> visited;
+
+    return !filename.empty() && includeNamesForkName(filename, visited);
+}
+
+bool Preprocessor::namesForkName(std::string_view line) const
+{
+    size_t pos = 0;
+    while (pos < line.size())
+    {
+        if (!isWordChar(line[pos])) {
+            pos++;
+            continue;
+        }
+
+        size_t start = pos;
+        while (pos < line.size() && isWordChar(line[pos]))
+            pos++;
+
+        if (fork_names.find(line.substr(start, pos - start)) != SymbolTable::NONE)
+            return true;
+    }
+
+    return false;
+}
+
+// Every file is scanned once per prefix run, the includes are followed on
+// each query so a guarded cycle cannot hide a name. A file that cannot be
+// read counts as naming one - the forks report it where the #include is
+bool Preprocessor::includeNamesForkName(const std::string& filename, std::unordered_set<std::string>& visited)
+{
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(filename, ec))
+        return true;
+
+    IncludeFile* file = loadInclude(filename);
+    if (!file)
+        return true;
+
+    if (!visited.insert(file->path).second)
+        return false;
+
+    auto it = fork_scans.find(file->path);
+    if (it == fork_scans.end())
+    {
+        ForkScan scan;
+        scan.names = false;
+
+        for (std::string_view line : *file->source)
+        {
+            PreprocessorDirective type;
+
+            if (namesForkName(line)) {
+                scan.names = true;
+                break;
+            }
+            if (peekPreprocessDirective(line, type) && type == PREP_INCLUDE)
+                scan.includes.push_back(parse_include(line));
+        }
+
+        it = fork_scans.emplace(file->path, std::move(scan)).first;
+    }
+
+    // the node stays put while the recursion adds others
+    const ForkScan& scan = it->second;
+    if (scan.names)
+        return true;
+
+    for (const auto& include : scan.includes)
+    {
+        if (!include.empty() && includeNamesForkName(include, visited))
+            return true;
+    }
+
+    return false;
+}
+
+// Everything the prefix built up, taken at a main file line - no include
+// is open and nothing is being recorded. Symbol ids are handed out again in
+// the same order, and the indexes are rebuilt over the copied maps
+void Preprocessor::copyState(const Preprocessor& base)
+{
+    is_okay = base.is_okay;
+    line_num = base.line_num;
+    state_stack = base.state_stack;
+
+    blocks = base.blocks;
+    defines = base.defines;
+
+    for (size_t id = 0; id < base.symbols.size(); id++)
+        symbols.intern(base.symbols.name(static_cast<int>(id)));
+    for (const auto& [name, def] : defines)
+        define_by_symbol.set(symbols.find(name), &def);
+    for (const auto& [name, block] : blocks)
+        macro_by_symbol.set(symbols.find(name), &block);
+
+    include_cache = base.include_cache;
+    include_hits = base.include_hits;
+    include_misses = base.include_misses;
+    include_skips = base.include_skips;
+    io_wait = base.io_wait;
+
+    snapshot_hits = base.snapshot_hits;
+    snapshot_misses = base.snapshot_misses;
+    snapshot_writes = base.snapshot_writes;
+
+    definition_generation = base.definition_generation;
+    cache_generation = base.cache_generation;
+    expansion_cache = base.expansion_cache;
+    cache_hits = base.cache_hits;
+    cache_misses = base.cache_misses;
+    expansion_errors = base.expansion_errors;
+
+    errors.append(base.errors);
+}
@@ -0,0 +1,419 @@
+#include "preprocessor.h"
+#include "utils.h"
+
+/*
+    Header snapshots - precompiled headers for the preprocessor.
+
+    A snapshot keeps what including a header did: the defines and compiled
+    macros it added, the code it emitted and the files it read. It also keeps
+    every lookup of a name the header did not define itself, so it is replayed
+    only while those names resolve the same way and every file it read still
+    has the same content hash.
+*/
+
+static const char SNAPSHOT_MAGIC[8] = { 'A', 'S', 'M', 'S', 'N', 'A', 'P', '\0' };
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+class SnapshotWriter
+{
+public:
+
+    void u8(uint8_t value) { data.push_back(static_cast<char>(value)); }
+    void u32(uint32_t value) { raw(&value, sizeof(value)); }
+    void u64(uint64_t value) { raw(&value, sizeof(value)); }
+
+    void str(std::string_view s)
+    {
+        u32(static_cast<uint32_t>(s.size()));
+        data.append(s);
+    }
+
+    void raw(const void* ptr, size_t size) { data.append(static_cast<const char*>(ptr), size); }
+
+    std::string data;
+};
+
+class SnapshotReader
+{
+public:
+
+    explicit SnapshotReader(std::string_view data) : data(data), pos(0), ok(true) {}
+
+    uint8_t u8() { uint8_t value = 0; raw(&value, sizeof(value)); return value; }
+    uint32_t u32() { uint32_t value = 0; raw(&value, sizeof(value)); return value; }
+    uint64_t u64() { uint64_t value = 0; raw(&value, sizeof(value)); return value; }
+
+    std::string_view str()
+    {
+        uint32_t size = u32();
+        if (!ok || data.size() - pos < size)
+        {
+            ok = false;
+            return {};
+        }
+
+        std::string_view s = data.substr(pos, size);
+        pos += size;
+        return s;
+    }
+
+    void raw(void* ptr, size_t size)
+    {
+        if (!ok || data.size() - pos < size)
+        {
+            ok = false;
+            return;
+        }
+
+        memcpy(ptr, data.data() + pos, size);
+        pos += size;
+    }
+
+    // Element count - never more than the bytes left, so a damaged file
+    // cannot ask for a huge allocation
+    uint32_t count()
+    {
+        uint32_t value = u32();
+        if (value > data.size() - pos)
+        {
+            ok = false;
+            return 0;
+        }
+        return value;
+    }
+
+    bool good() const { return ok; }
+
+private:
+
+    std::string_view data;
+    size_t pos;
+    bool ok;
+};
+
+void Preprocessor::setSnapshotDir(const std::string& dir)
+{
+    snapshot_dir = dir;
+}
+
+void Preprocessor::setSharedSnapshots(SharedSnapshots* shared)
+{
+    shared_snapshots = shared;
+}
+
+std::string Preprocessor::snapshotPath(const std::string& key) const
+{
+    std::string name = qsprintf("%016llx.pch", static_cast<unsigned long long>(content_hash(key)));
+    return (std::filesystem::path(snapshot_dir) / name).string();
+}
+
+uint64_t Preprocessor::fileHash(IncludeFile& file) const
+{
+    if (!file.hashed)
+    {
+        file.hash = content_hash(file.source->text());
+        file.hashed = true;
+    }
+
+    return file.hash;
+}
+
+std::vector<FileDependency> Preprocessor::includedFiles()
+{
+    std::vector<FileDependency> files;
+    files.reserve(include_cache.size());
+
+    for (auto& entry : include_cache)
+        files.push_back({ entry.first, fileHash(entry.second) });
+
+    return files;
+}
+
+uint64_t Preprocessor::macroHash(const MacroBlock& block)
+{
+    uint64_t h = content_hash(block.name);
+
+    for (const auto& arg : block.args)
+        h = content_hash(arg, content_hash(",", h));
+
+    for (const auto& line : block.body)
+    {
+        h = content_hash("\n", h);
+
+        for (const auto& seg : line.segments)
+        {
+            h = content_hash(std::string_view(reinterpret_cast<const char*>(&seg.param), sizeof(seg.param)), h);
+            h = content_hash(seg.text, h);
+        }
+    }
+
+    return h;
+}
+
+void Preprocessor::recordDefineLookup(std::string_view name, const Define* def) const
+{
+    std::string key = "d:";
+    key.append(name);
+
+    if (!recording->seen.insert(std::move(key)).second)
+        return;
+
+    recording->dependencies.push_back({ false, std::string(name), def != nullptr, def ? content_hash(def->value) : 0 });
+}
+
+void Preprocessor::recordMacroLookup(std::string_view name, const MacroBlock* block) const
+{
+    std::string key = "m:";
+    key.append(name);
+
+    if (!recording->seen.insert(std::move(key)).second)
+        return;
+
+    recording->dependencies.push_back({ true, std::string(name), block != nullptr, block ? macroHash(*block) : 0 });
+}
+
+void Preprocessor::beginSnapshot(const IncludeFile& file)
+{
+    recording = std::make_unique<SnapshotRecording>();
+    recording->key = file.path;
+    recording->code_start = preprocessed_code.size();
+    recording->stack_depth = state_stack.size();
+    recording->files.push_back(file.path);
+}
+
+void Preprocessor::endSnapshot(bool result)
+{
+    std::unique_ptr<SnapshotRecording> rec = std::move(recording);
+
+    // a header that failed or left a block open is not reusable
+    if (!result || errors.has_errors() || state_stack.size() != rec->stack_depth)
+        return;
+
+    SnapshotWriter out;
+    out.raw(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    out.u32(SNAPSHOT_VERSION);
+
+    out.u32(static_cast<uint32_t>(rec->files.size()));
+    for (const auto& path : rec->files)
+    {
+        auto it = include_cache.find(path);
+        if (it == include_cache.end())
+            return;
+
+        out.str(path);
+        out.u64(fileHash(it->second));
+        out.u8(it->second.once);
+    }
+
+    out.u32(static_cast<uint32_t>(rec->dependencies.size()));
+    for (const auto& dep : rec->dependencies)
+    {
+        out.u8(dep.macro);
+        out.str(dep.name);
+        out.u8(dep.present);
+        out.u64(dep.value);
+    }
+
+    out.u32(static_cast<uint32_t>(rec->defines.size()));
+    for (const auto& name : rec->defines)
+    {
+        const Define& def = defines.at(name);
+        out.u32(static_cast<uint32_t>(def.start_line));
+        out.str(def.name);
+        out.str(def.value);
+    }
+
+    out.u32(static_cast<uint32_t>(rec->macros.size()));
+    for (const auto& name : rec->macros)
+    {
+        const MacroBlock& block = blocks.find(name)->second;
+        out.u32(static_cast<uint32_t>(block.start_line));
+        out.str(block.name);
+
+        out.u32(static_cast<uint32_t>(block.args.size()));
+        for (const auto& arg : block.args)
+            out.str(arg);
+
+        out.u32(static_cast<uint32_t>(block.body.size()));
+        for (const auto& line : block.body)
+        {
+            out.u32(static_cast<uint32_t>(line.segments.size()));
+            for (const auto& seg : line.segments)
+            {
+                out.u32(static_cast<uint32_t>(seg.param));
+                out.str(seg.text);
+            }
+        }
+    }
+
+    rec->code.append(preprocessed_code, rec->code_start, std::string::npos);
+    out.str(rec->code);
+
+    if (shared_snapshots)
+    {
+        shared_snapshots->add(rec->key, fileHash(include_cache.at(rec->key)), std::make_shared<std::string>(out.data));
+        qprintf(verbose, 2, "SNAPSHOT KEPT: %s", rec->key.c_str());
+    }
+
+    if (!snapshot_dir.empty())
+    {
+        // written aside and renamed, so a concurrent build never reads half a file
+        std::error_code ec;
+        std::filesystem::create_directories(snapshot_dir, ec);
+
+        if (!writeFileAtomic(snapshotPath(rec->key), out.data))
+            return;
+
+        qprintf(verbose, 2, "SNAPSHOT WRITTEN: %s", rec->key.c_str());
+    }
+
+    snapshot_writes++;
+}
+
+// From memory first, then from the directory - a snapshot read from
+// the directory is kept in memory once it replays
+bool Preprocessor::loadSnapshot(IncludeFile& file)
+{
+    std::shared_ptr<const std::string> kept;
+    std::string data;
+
+    bool in_memory = shared_snapshots && shared_snapshots->find(file.path, fileHash(file), kept);
+    if (!in_memory && (snapshot_dir.empty() || !readWholeFile(snapshotPath(file.path), data)))
+    {
+        snapshot_misses++;
+        return false;
+    }
+
+    auto reject = [&](const char* reason) {
+        qprintf(verbose, 2, "SNAPSHOT REJECTED: %s - %s", file.path.c_str(), reason);
+        snapshot_misses++;
+        return false;
+    };
+
+    SnapshotReader reader(in_memory ? std::string_view(*kept) : std::string_view(data));
+
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    reader.raw(magic, sizeof(magic));
+    if (!reader.good() || memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) || reader.u32() != SNAPSHOT_VERSION)
+        return reject("not a snapshot");
+
+    std::vector<IncludeFile*> once_files;
+
+    uint32_t files_num = reader.count();
+    for (uint32_t i = 0; i < files_num && reader.good(); i++)
+    {
+        std::string path(reader.str());
+        uint64_t hash = reader.u64();
+        bool once = reader.u8() != 0;
+
+        IncludeFile* dep = &file;
+        if (path != file.path)
+        {
+            std::error_code ec;
+            if (!std::filesystem::exists(path, ec))
+                return reject("included file is gone");
+
+            dep = loadInclude(path);
+            if (!dep)
+                return reject("included file is unreadable");
+        }
+
+        if (fileHash(*dep) != hash)
+            return reject("source changed");
+
+        if (once)
+            once_files.push_back(dep);
+    }
+
+    uint32_t deps_num = reader.count();
+    for (uint32_t i = 0; i < deps_num && reader.good(); i++)
+    {
+        bool macro = reader.u8() != 0;
+        std::string_view name = reader.str();
+        bool present = reader.u8() != 0;
+        uint64_t value = reader.u64();
+
+        bool now_present;
+        uint64_t now_value = 0;
+
+        if (macro)
+        {
+            const MacroBlock* block = findMacro(name);
+            now_present = block != nullptr;
+            if (block)
+                now_value = macroHash(*block);
+        }
+        else
+        {
+            const Define* def = findDefine(name);
+            now_present = def != nullptr;
+            if (def)
+                now_value = content_hash(def->value);
+        }
+
+        if (now_present != present || now_value != value)
+            return reject("depends on a different definition");
+    }
+
+    std::vector<Define> new_defines(reader.count());
+    for (auto& def : new_defines)
+    {
+        def.start_line = static_cast<int>(reader.u32());
+        def.name = reader.str();
+        def.value = reader.str();
+    }
+
+    std::vector<MacroBlock> new_macros(reader.count());
+    for (auto& block : new_macros)
+    {
+        block.start_line = static_cast<int>(reader.u32());
+        block.name = reader.str();
+        block.type = PREP_MACRO;
+
+        block.args.resize(reader.count());
+        for (auto& arg : block.args)
+            arg = reader.str();
+
+        block.body.resize(reader.count());
+        for (auto& line : block.body)
+        {
+            line.literal_size = 0;
+            line.segments.resize(reader.count());
+
+            for (auto& seg : line.segments)
+            {
+                seg.param = static_cast<int>(reader.u32());
+                seg.text = reader.str();
+                if (seg.param < 0)
+                    line.literal_size += seg.text.size();
+            }
+        }
+    }
+
+    std::string_view code = reader.str();
+
+    if (!reader.good())
+        return reject("truncated");
+
+    for (auto& def : new_defines)
+        storeDefine(std::move(def));
+
+    for (auto& block : new_macros)
+        storeMacro(std::move(block));
+
+    if (!new_defines.empty() || !new_macros.empty())
+        definition_generation++;
+
+    for (auto* dep : once_files)
+        dep->once = true;
+
+    preprocessed_code.append(code);
+
+    if (shared_snapshots && !in_memory)
+        shared_snapshots->add(file.path, fileHash(file), std::make_shared<std::string>(std::move(data)));
+
+    snapshot_hits++;
+    qprintf(verbose, 2, "SNAPSHOT: %s", file.path.c_str());
+
+    return true;
+}
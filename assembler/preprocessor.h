@@ -1,13 +1,19 @@
 #pragma once
 
 #include "common.h"
+#include "lexer.h"
+#include "source_text.h"
+#include "line_stream.h"
+#include "symbol_table.h"
+#include "shared_includes.h"
+#include "include_prefetch.h"
 
 /**
  * @class Preprocessor
  * @brief Assembler preprocessor for handling directives and macros
  *
  * Handles directives: #include, #define, #if, #ifdef, #ifndef,
- * #elif, #else, #endif, #macro, #endmacro
+ * #elif, #else, #endif, #macro, #endmacro, #once
  */
 class Preprocessor
 {
@@ -17,7 +23,46 @@ public:
     virtual ~Preprocessor() = default;
 
     // ==================== PUBLIC INTERFACE ====================
-    std::string preprocess(const std::string& source, bool verbose = false);
+    std::string preprocess(std::string source, bool verbose = false);
+
+    // Streams the output to every sink in blocks of whole lines and closes them,
+    // the output is never held whole. Returns false on errors
+    bool preprocess(std::string source, const std::vector<TextSink*>& sinks, bool verbose = false);
+
+    // Same, but the source file is read in blocks of lines rather than whole
+    bool preprocessFile(const std::string& filename, const std::vector<TextSink*>& sinks, bool verbose = false);
+
+    // Directory for header snapshots, empty disables them
+    void setSnapshotDir(const std::string& dir);
+
+    // Header snapshots kept in memory across runs, nullptr - only the directory's
+    void setSharedSnapshots(SharedSnapshots* shared);
+
+    // Include files read by other preprocessors too, nullptr - only this one's own cache
+    void setSharedIncludes(SharedIncludes* shared);
+
+    // Reads include files ahead on I/O threads, nullptr - each is read when reached
+    void setPrefetch(IncludePrefetch* prefetch);
+
+    // Defined before the source of every run, as if by #define NAME VALUE
+    void define(const std::string& name, const std::string& value);
+
+    // One source under several sets of defines (preprocess_matrix.cpp).
+    // preprocessPrefix() runs the lines before the first one that can tell the
+    // sets apart - one naming any of fork_names, or including a file that does -
+    // and stops there, leaving the sinks open. preprocessFork() copies the state
+    // of such a base and goes on from there with this instance's own defines added.
+    // Both return false on errors, the prefix errors are reported by every fork
+    bool preprocessPrefix(std::string source, const std::vector<std::string>& fork_names,
+        const std::vector<TextSink*>& sinks, bool verbose = false);
+    bool preprocessFork(const Preprocessor& base, const std::vector<TextSink*>& sinks, bool verbose = false);
+
+    // Every file #include loaded in the last preprocess() with its content hash
+    std::vector<FileDependency> includedFiles();
+
+    // Errors of the last preprocess(), every instance has its own
+    const ErrorLog& diagnostics() const;
+
     bool is_ok() const;
     void clear();
 
@@ -42,14 +87,72 @@ private:
         std::string value;     ///< Constant value
     };
 
+    /// @brief Piece of a compiled macro body line
+    struct MacroSegment
+    {
+        int param;                         ///< Argument slot, -1 for literal text
+        std::string text;                  ///< Literal text
+    };
+
+    /// @brief Macro body line compiled into literal segments and argument slots
+    struct MacroLine
+    {
+        std::vector<MacroSegment> segments;
+        size_t literal_size;               ///< Total length of literal segments
+    };
+
     /// @brief Macro definition block
     struct MacroBlock
     {
         int start_line;                    ///< Line number where macro starts
         std::string name;                  ///< Macro name
         PreprocessorDirective type;        ///< Directive type
-        std::list<std::string> args;       ///< Macro arguments
-        std::list<std::string> lines;      ///< Macro body lines
+        std::vector<std::string> args;     ///< Macro arguments
+        std::list<std::string> lines;      ///< Macro body lines, cleared once compiled
+        std::vector<MacroLine> body;       ///< Body compiled at #endmacro
+    };
+
+    /// @brief Included file, loaded once per run
+    struct IncludeFile
+    {
+        std::string path;                       ///< Canonical path, the cache key
+        std::filesystem::file_time_type mtime;  ///< Modification time the contents were read at
+        std::shared_ptr<const SourceText> source;  ///< Line-split contents, may be shared with other preprocessors
+        std::string guard;                      ///< #ifndef guard macro covering the whole file, empty if none
+        bool once;                              ///< File contains #once
+        int active;                             ///< How many times the file is being processed right now
+        bool hashed;                            ///< hash is computed
+        uint64_t hash;                          ///< Content hash, for snapshots
+    };
+
+    /// @brief Lookup of a name defined outside the header being snapshotted
+    struct SnapshotDependency
+    {
+        bool macro;                             ///< Macro block or #define
+        std::string name;
+        bool present;                           ///< Name existed
+        uint64_t value;                         ///< Hash of the define value / macro body
+    };
+
+    /// @brief State collected while a header is preprocessed for a snapshot
+    struct SnapshotRecording
+    {
+        std::string key;                                ///< Canonical path of the header
+        size_t code_start;                              ///< Output offset the header starts at
+        std::string code;                               ///< Header output already flushed to the sinks
+        size_t stack_depth;                             ///< State stack size at the #include
+        std::vector<std::string> files;                 ///< Files read, the header included
+        std::vector<SnapshotDependency> dependencies;
+        std::unordered_set<std::string> seen;           ///< Names already recorded or defined by the header
+        std::vector<std::string> defines;               ///< Defines added by the header
+        std::vector<std::string> macros;                ///< Macros added by the header
+    };
+
+    /// @brief What a prefix run found in an include file
+    struct ForkScan
+    {
+        bool names;                             ///< The file itself names one of fork_names
+        std::vector<std::string> includes;      ///< Files it includes, as written
     };
 
     /// @brief Preprocessor state frame for stack
@@ -71,27 +174,59 @@ private:
 
     // ==================== CONSTANTS ====================
     static const int MAX_INCLUDE_DEPTH = 64;  ///< Maximum include nesting depth
+    static const size_t OUTPUT_BLOCK_SIZE = 64 * 1024;  ///< Output is flushed to the sinks in blocks of about this size
 
 private:
     // ==================== PROCESSING METHODS ====================
-    bool prep_pass(const std::list<std::string>& lines);
-    bool process_line(const std::string& line);
+    bool prep_pass(const SourceText& lines);
+    bool passLines(const SourceText& lines, int& skip_depth, size_t first = 0);
+    size_t skipInactiveRegion(const SourceText& lines, size_t first, int& depth) const;
+    bool finishPreprocess(bool result);
+    bool applyPredefined();
+    bool process_line(std::string_view line);
+    void flushOutput();
 
     // Preprocessor directive handlers
-    bool preprocessInclude(const std::string& line);
-    bool preprocessDefine(const std::string& line);
-    bool preprocessElse(const std::string& line);
-    bool preprocessElifdef(const std::string& line);
-    bool preprocessElifndef(const std::string& line);
-    bool preprocessIfdef(const std::string& line);
-    bool preprocessIfndef(const std::string& line);
-    bool preprocessEndif(const std::string& line);
-    bool preprocessMacro(const std::string& line);
-    bool preprocessEndMacro(const std::string& line);
-    bool preprocessReadingDefinition(const std::string& line);
-
-    bool expandMacroInvocation(const std::string& line) const;
-    std::string expandMacros(const std::string& line) const;
+    bool preprocessInclude(std::string_view line);
+    bool preprocessOnce(std::string_view line);
+    bool preprocessDefine(std::string_view line);
+    bool preprocessElse(std::string_view line);
+    bool preprocessElifdef(std::string_view line, const TokenList& tokens);
+    bool preprocessElifndef(std::string_view line, const TokenList& tokens);
+    bool preprocessIfdef(std::string_view line, const TokenList& tokens);
+    bool preprocessIfndef(std::string_view line, const TokenList& tokens);
+    bool preprocessEndif(std::string_view line);
+    bool preprocessMacro(std::string_view line);
+    bool preprocessEndMacro(std::string_view line);
+    bool preprocessReadingDefinition(std::string_view line, const TokenList& tokens);
+
+    static void compileMacroBody(MacroBlock& block);
+    bool expandMacroInvocation(std::string_view line, const TokenList& tokens) const;
+    std::string expandMacros(std::string_view line) const;
+    const Define* findDefine(std::string_view name) const;
+    void storeDefine(Define def);
+    void storeMacro(MacroBlock block);
+
+    // Include cache
+    IncludeFile* loadInclude(const std::string& filename);
+    static std::string detectIncludeGuard(const SourceText& source);
+
+    // Header snapshots (preprocess_snapshot.cpp)
+    bool loadSnapshot(IncludeFile& file);
+    void beginSnapshot(const IncludeFile& file);
+    void endSnapshot(bool result);
+    std::string snapshotPath(const std::string& key) const;
+    uint64_t fileHash(IncludeFile& file) const;
+    static uint64_t macroHash(const MacroBlock& block);
+    void recordDefineLookup(std::string_view name, const Define* def) const;
+    void recordMacroLookup(std::string_view name, const MacroBlock* block) const;
+    const MacroBlock* findMacro(std::string_view name) const;
+
+    // Configuration matrix (preprocess_matrix.cpp)
+    bool forkStartsAt(std::string_view line);
+    bool namesForkName(std::string_view line) const;
+    bool includeNamesForkName(const std::string& filename, std::unordered_set<std::string>& visited);
+    void copyState(const Preprocessor& base);
 
     // ==================== STATE MANAGEMENT ====================
     bool pushState(const std::string& name, PreprocessorDirective type,
@@ -108,8 +243,8 @@ private:
     bool wasConditionMetInCurrentBlock() const;
 
     // Evaluation methods
-    bool evaluateCondition(const std::string& condition) const;
-    bool isDefined(const std::string& macroName) const;
+    bool evaluateCondition(std::string_view condition) const;
+    bool isDefined(std::string_view macroName) const;
 
     // ==================== MEMBER VARIABLES ====================
     bool is_okay;                           ///< Whether preprocessing completed successfully
@@ -119,8 +254,50 @@ private:
 
     std::stack<PreprocessorState> state_stack;  ///< State stack for nested processing
 
-    std::map<std::string, MacroBlock> blocks;   ///< Defined macro blocks
-    std::map<std::string, Define> defines;      ///< Defined constants
+    std::map<std::string, MacroBlock, std::less<>> blocks;   ///< Defined macro blocks
+    std::unordered_map<std::string, Define> defines;         ///< Defined constants, values already expanded
+
+    SymbolTable symbols;                                     ///< Names of defines and macros
+    SymbolIndex<const Define> define_by_symbol;              ///< Lookup side of defines, by symbol id
+    SymbolIndex<const MacroBlock> macro_by_symbol;           ///< Lookup side of blocks, by symbol id
+
+    std::string preprocessed_code;          ///< Output not yet flushed to the sinks
+    std::vector<TextSink*> sinks;           ///< Receivers of the output
+
+    std::unordered_map<std::string, IncludeFile> include_cache;  ///< Canonical path -> loaded file
+    std::vector<IncludeFile*> include_stack;                      ///< Files being processed, innermost last
+    SharedIncludes* shared_includes;                              ///< Contents read by any preprocessor, may be nullptr
+    size_t include_hits;
+    size_t include_misses;
+    size_t include_skips;                   ///< Includes dropped by #once or a defined guard
+    IncludePrefetch* prefetch;              ///< May be nullptr
+    double io_wait;                         ///< Seconds spent waiting for include files
+
+    std::string snapshot_dir;               ///< Where header snapshots live, empty - disabled
+    SharedSnapshots* shared_snapshots;      ///< Snapshots in memory, may be nullptr
+    mutable std::unique_ptr<SnapshotRecording> recording;  ///< Header being snapshotted, if any
+    size_t snapshot_hits;
+    size_t snapshot_misses;
+    size_t snapshot_writes;
+
+    // Macro expansion cache: (macro name, arguments) -> expanded text, nested expansions included.
+    // Any new #define or #macro can change an expansion, so entries live for one generation.
+    unsigned definition_generation;                                   ///< Bumped by every #define and #macro
+    mutable unsigned cache_generation;                                ///< Generation of the cached entries
+    mutable std::unordered_map<std::string, std::string> expansion_cache;
+    mutable size_t cache_hits;
+    mutable size_t cache_misses;
+    mutable int expansion_errors;           ///< Errors reported while expanding, failed expansions are not cached
+    mutable std::vector<std::string> expansion_stack;  ///< Macros being expanded, to catch recursion
+
+    std::vector<std::pair<std::string, std::string>> predefined;  ///< define() names and values, kept by clear()
+
+    SymbolTable fork_names;                 ///< Names the configurations define differently, empty - not a prefix run
+    std::unordered_map<std::string, ForkScan> fork_scans; ///< Canonical path -> what the file names and includes
+    std::shared_ptr<const SourceText> fork_source;        ///< Main file of the prefix run
+    size_t fork_line;                       ///< First main file line left to the forks
+    int fork_skip_depth;                    ///< skip_depth of passLines() at fork_line
+    bool fork_result;                       ///< The prefix had no errors
 
-    std::string preprocessed_code;          ///< Resulting preprocessed code
+    mutable ErrorLog errors;                ///< Diagnostics of this instance, const expansion reports too
 };
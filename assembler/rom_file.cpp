@@ -0,0 +1,171 @@
+#include "rom_file.h"
+#include "utils.h"
+
+RomFile::RomFile(const std::string& output_file, bool verilog, address_t rom_size)
+    : output_file(output_file)
+    , image_file(tempFileName(output_file))
+    , verilog(verilog)
+    , rom_size(rom_size)
+    , image(image_file, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc)
+    , pending_address(0)
+{
+    pending.reserve(BUFFER_WORDS);
+}
+
+RomFile::~RomFile()
+{
+    if (image.is_open())
+        image.close();
+
+    std::error_code ec;
+    std::filesystem::remove(image_file, ec);
+}
+
+void RomFile::write(address_t image_address, const instruction_t* words, size_t count)
+{
+    if (image_address >= rom_size)
+        return;
+
+    count = std::min(count, static_cast<size_t>(rom_size - image_address));
+
+    if (!pending.empty() && (image_address != pending_address + static_cast<address_t>(pending.size()) || pending.size() >= BUFFER_WORDS))
+        flush();
+
+    if (pending.empty())
+        pending_address = image_address;
+
+    pending.insert(pending.end(), words, words + count);
+}
+
+void RomFile::flush()
+{
+    if (!pending.empty() && image.is_open())
+    {
+        image.seekp(static_cast<std::streamoff>(pending_address) * sizeof(instruction_t));
+        image.write(reinterpret_cast<const char*>(pending.data()), pending.size() * sizeof(instruction_t));
+    }
+
+    pending.clear();
+}
+
+// Words never written - past the end of the image - read as zero
+bool RomFile::readImage(address_t image_address, instruction_t* words, size_t count)
+{
+    image.seekg(static_cast<std::streamoff>(image_address) * sizeof(instruction_t));
+    image.read(reinterpret_cast<char*>(words), count * sizeof(instruction_t));
+
+    size_t got = static_cast<size_t>(image.gcount()) / sizeof(instruction_t);
+    std::fill(words + got, words + count, instruction_t(0));
+
+    if (image.bad())
+        return false;
+
+    image.clear();
+    return true;
+}
+
+bool RomFile::finish(const std::vector<RomRange>& layout, ErrorLog& log, bool verbose)
+{
+    flush();
+
+    if (!image.is_open())
+    {
+        log.addError(ErrorLog::FILE_CANNOT_OPEN, output_file, -1);
+        return false;
+    }
+
+    if (!image.good() || !writeOutput(layout, verbose))
+    {
+        log.addError(ErrorLog::FILE_CANNOT_WRITE, output_file, -1);
+        return false;
+    }
+
+    return true;
+}
+
+bool RomFile::writeOutput(const std::vector<RomRange>& layout, bool verbose)
+{
+    address_t total_size = 0;
+    bool in_place = true;
+
+    for (const auto& range : layout)
+    {
+        if (range.image_address != total_size)
+            in_place = false;
+        total_size += range.size;
+    }
+
+    std::error_code ec;
+
+    // blocks are already in output order - the image is the binary output
+    if (!verilog && in_place)
+    {
+        qprintf(verbose, 1, "Writing binary format (%zu bytes) in place", static_cast<size_t>(total_size) * sizeof(instruction_t));
+
+        image.close();
+        std::filesystem::resize_file(image_file, static_cast<uintmax_t>(total_size) * sizeof(instruction_t), ec);
+        if (!ec)
+            std::filesystem::rename(image_file, output_file, ec);
+        return !ec;
+    }
+
+    qprintf(verbose, 1, "Writing %s format (%d instructions)", verilog ? "COE" : "binary", total_size);
+
+    std::string out_file = tempFileName(output_file);
+    std::ofstream out(out_file, verilog ? std::ios::out : std::ios::binary);
+    if (!out.is_open())
+        return false;
+
+    if (verilog)
+    {
+        out << "memory_initialization_radix=2;" << '\n';
+        out << "memory_initialization_vector=" << '\n';
+    }
+
+    std::vector<instruction_t> buffer(BUFFER_WORDS);
+    address_t written = 0;
+
+    for (const auto& range : layout)
+    {
+        for (address_t done = 0; done < range.size; )
+        {
+            size_t count = std::min(buffer.size(), static_cast<size_t>(range.size - done));
+            if (!readImage(range.image_address + done, buffer.data(), count))
+                break;
+
+            if (verilog)
+            {
+                for (size_t i = 0; i < count; i++)
+                {
+                    out << instructionToBinaryString(buffer[i]);
+                    if (++written < total_size)
+                        out << ',';
+                    out << '\n';
+                }
+            }
+            else
+            {
+                out.write(reinterpret_cast<const char*>(buffer.data()), count * sizeof(instruction_t));
+            }
+
+            done += static_cast<address_t>(count);
+        }
+    }
+
+    if (verilog)
+        out << ';' << '\n';
+
+    out.close();
+
+    if (!out.good() || image.bad())
+    {
+        std::filesystem::remove(out_file, ec);
+        return false;
+    }
+
+    std::filesystem::rename(out_file, output_file, ec);
+    if (ec)
+        std::filesystem::remove(out_file, ec);
+
+    return !ec;
+}
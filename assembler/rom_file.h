@@ -0,0 +1,55 @@
+#pragma once
+
+#include "common.h"
+
+/*
+	ROM image kept in a file instead of memory, for sources that are
+	mostly data.
+
+	Blocks are written to the image in source order as they are parsed,
+	words past the ROM size are dropped (the layout reports the overflow).
+	finish() copies the blocks to the output in their final order -
+	the entry point block first - in the format writeFile() uses.
+	Nothing is left behind if finish() is not reached.
+*/
+
+struct RomRange
+{
+	address_t image_address;    // where the block is in the image
+	address_t size;
+};
+
+class RomFile
+{
+public:
+
+	RomFile(const std::string& output_file, bool verilog, address_t rom_size);
+	~RomFile();
+
+	RomFile(const RomFile&) = delete;
+	RomFile& operator=(const RomFile&) = delete;
+
+	void write(address_t image_address, const instruction_t* words, size_t count);
+
+	// layout - the blocks in output order
+	bool finish(const std::vector<RomRange>& layout, ErrorLog& log, bool verbose);
+
+private:
+
+	void flush();
+	bool readImage(address_t image_address, instruction_t* words, size_t count);
+	bool writeOutput(const std::vector<RomRange>& layout, bool verbose);
+
+	std::string output_file;
+	std::string image_file;
+	bool verilog;
+	address_t rom_size;
+
+	std::fstream image;
+
+	// consecutive writes are collected here before they go to the file
+	std::vector<instruction_t> pending;
+	address_t pending_address;
+
+	static const size_t BUFFER_WORDS = 64 * 1024;
+};
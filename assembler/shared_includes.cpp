@@ -0,0 +1,37 @@
+#include "shared_includes.h"
+
+bool SharedIncludes::find(const std::string& path, std::filesystem::file_time_type mtime, File& file) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = files.find(path);
+    if (it == files.end() || it->second.mtime != mtime)
+        return false;
+
+    file = it->second;
+    return true;
+}
+
+void SharedIncludes::add(const std::string& path, const File& file)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    files[path] = file;
+}
+
+bool SharedSnapshots::find(const std::string& path, uint64_t hash, std::shared_ptr<const std::string>& data) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = snapshots.find(path);
+    if (it == snapshots.end() || it->second.hash != hash)
+        return false;
+
+    data = it->second.data;
+    return true;
+}
+
+void SharedSnapshots::add(const std::string& path, uint64_t hash, std::shared_ptr<const std::string> data)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    snapshots[path] = { hash, std::move(data) };
+}
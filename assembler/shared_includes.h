@@ -0,0 +1,66 @@
+#pragma once
+
+#include "common.h"
+#include "source_text.h"
+
+/*
+	Include files shared between preprocessors.
+
+	Jobs of one batch include the same headers, so a header is read, split
+	into lines and scanned for an include guard once per process. Entries
+	never change once added; a file whose modification time differs from
+	the entry is read again and replaces it. What depends on one run -
+	#once, nesting, hashes - stays in each Preprocessor.
+*/
+
+class SharedIncludes
+{
+public:
+
+	struct File
+	{
+		std::filesystem::file_time_type mtime;
+		std::shared_ptr<const SourceText> source;
+		std::string guard;                  // empty - no include guard
+	};
+
+	// false - never added or the file changed since
+	bool find(const std::string& path, std::filesystem::file_time_type mtime, File& file) const;
+
+	void add(const std::string& path, const File& file);
+
+private:
+
+	mutable std::mutex mutex;
+	std::unordered_map<std::string, File> files;
+};
+
+/*
+	Header snapshots kept in memory for a build server.
+
+	One per header path, recorded for the header's content hash; a header
+	that changed misses and its new snapshot replaces the old one. The
+	snapshot checks the rest - other files it read, names it looked up -
+	itself when it is replayed.
+*/
+
+class SharedSnapshots
+{
+public:
+
+	// false - none for this content of the header
+	bool find(const std::string& path, uint64_t hash, std::shared_ptr<const std::string>& data) const;
+
+	void add(const std::string& path, uint64_t hash, std::shared_ptr<const std::string> data);
+
+private:
+
+	struct Snapshot
+	{
+		uint64_t hash;
+		std::shared_ptr<const std::string> data;
+	};
+
+	mutable std::mutex mutex;
+	std::unordered_map<std::string, Snapshot> snapshots;
+};
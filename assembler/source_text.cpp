@@ -0,0 +1,19 @@
+#include "source_text.h"
+
+SourceText::SourceText(std::string text, bool trim_lines, bool del_comms)
+{
+    assign(std::move(text), trim_lines, del_comms);
+}
+
+void SourceText::assign(std::string text, bool trim_lines, bool del_comms)
+{
+    buffer = std::move(text);
+    spans.clear();
+    scanLines(buffer, trim_lines, del_comms, spans);
+}
+
+void SourceText::clear()
+{
+    buffer.clear();
+    spans.clear();
+}
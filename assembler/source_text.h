@@ -0,0 +1,57 @@
+#pragma once
+
+#include "common.h"
+#include "line_scanner.h"
+
+/*
+	Source text kept in one owned buffer plus an index of line spans.
+
+	Comment stripping and trimming only narrow a span, so lines are
+	string_views into the buffer and nothing is copied per line.
+	The views stay valid while the SourceText is alive and unchanged.
+*/
+
+class SourceText
+{
+public:
+
+	class const_iterator
+	{
+	public:
+
+		const_iterator(const SourceText* source, size_t pos) : source(source), pos(pos) {}
+
+		std::string_view operator*() const { return (*source)[pos]; }
+		const_iterator& operator++() { pos++; return *this; }
+		bool operator!=(const const_iterator& other) const { return pos != other.pos; }
+
+	private:
+
+		const SourceText* source;
+		size_t pos;
+	};
+
+	SourceText() = default;
+	explicit SourceText(std::string text, bool trim_lines = true, bool del_comms = true);
+
+	void assign(std::string text, bool trim_lines = true, bool del_comms = true);
+	void clear();
+
+	size_t size() const { return spans.size(); }
+	bool empty() const { return spans.empty(); }
+
+	std::string_view operator[](size_t i) const
+	{
+		return std::string_view(buffer.data() + spans[i].offset, spans[i].length);
+	}
+
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, spans.size()); }
+
+	const std::string& text() const { return buffer; }
+
+private:
+
+	std::string buffer;
+	std::vector<LineSpan> spans;
+};
@@ -0,0 +1,108 @@
+#include "symbol_table.h"
+
+SymbolTable::SymbolTable()
+    : arena_next(nullptr)
+    , arena_left(0)
+{
+}
+
+int SymbolTable::intern(std::string_view name)
+{
+    size_t hash = std::hash<std::string_view>()(name);
+
+    if (!slots.empty())
+    {
+        size_t slot = findSlot(name, hash);
+        if (slots[slot].id != NONE)
+            return slots[slot].id;
+    }
+
+    if ((names.size() + 1) * 2 > slots.size())
+        grow();
+
+    int id = static_cast<int>(names.size());
+    names.push_back(store(name));
+    slots[findSlot(name, hash)] = { hash, id };
+
+    return id;
+}
+
+int SymbolTable::find(std::string_view name) const
+{
+    if (slots.empty())
+        return NONE;
+
+    return slots[findSlot(name, std::hash<std::string_view>()(name))].id;
+}
+
+// Slot holding the name, or the empty slot where it would go
+size_t SymbolTable::findSlot(std::string_view name, size_t hash) const
+{
+    size_t mask = slots.size() - 1;
+
+    for (size_t slot = hash & mask; ; slot = (slot + 1) & mask)
+    {
+        const Slot& s = slots[slot];
+        if (s.id == NONE || (s.hash == hash && names[s.id] == name))
+            return slot;
+    }
+}
+
+void SymbolTable::grow()
+{
+    std::vector<Slot> old = std::move(slots);
+    slots.assign(std::max<size_t>(64, old.size() * 2), Slot{ 0, NONE });
+
+    size_t mask = slots.size() - 1;
+
+    for (const Slot& s : old)
+    {
+        if (s.id == NONE)
+            continue;
+
+        size_t slot = s.hash & mask;
+        while (slots[slot].id != NONE)
+            slot = (slot + 1) & mask;
+        slots[slot] = s;
+    }
+}
+
+std::string_view SymbolTable::name(int id) const
+{
+    return names[id];
+}
+
+size_t SymbolTable::size() const
+{
+    return names.size();
+}
+
+void SymbolTable::clear()
+{
+    slots.clear();
+    names.clear();
+    arena.clear();
+    arena_next = nullptr;
+    arena_left = 0;
+}
+
+// Names are packed into big blocks, a name longer than a block gets its own
+std::string_view SymbolTable::store(std::string_view name)
+{
+    if (name.size() > arena_left)
+    {
+        size_t size = std::max(ARENA_BLOCK_SIZE, name.size());
+        arena.push_back(std::make_unique<char[]>(size));
+
+        arena_next = arena.back().get();
+        arena_left = size;
+    }
+
+    char* stored = arena_next;
+    std::memcpy(stored, name.data(), name.size());
+
+    arena_next += name.size();
+    arena_left -= name.size();
+
+    return std::string_view(stored, name.size());
+}
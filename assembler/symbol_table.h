@@ -0,0 +1,83 @@
+#pragma once
+
+#include "common.h"
+
+/*
+	Interned identifiers.
+
+	Every name gets a dense integer id the first time it is seen and is
+	hashed only then. Tables keyed by name become flat vectors indexed by
+	id (SymbolIndex), so lookups and duplicate checks compare no strings.
+	The names are kept in an arena, the views returned by name() stay
+	valid until clear().
+*/
+
+class SymbolTable
+{
+public:
+
+	static const int NONE = -1;
+
+	SymbolTable();
+
+	// Id of the name, a new one if it was never seen
+	int intern(std::string_view name);
+
+	// Id of the name, NONE if it was never seen
+	int find(std::string_view name) const;
+
+	std::string_view name(int id) const;
+	size_t size() const;
+
+	void clear();
+
+private:
+
+	static const size_t ARENA_BLOCK_SIZE = 64 * 1024;
+
+	// Open addressing, a name is compared only when its whole hash matches
+	struct Slot
+	{
+		size_t hash;
+		int id;             // NONE - empty
+	};
+
+	size_t findSlot(std::string_view name, size_t hash) const;
+	void grow();
+	std::string_view store(std::string_view name);
+
+	std::vector<std::unique_ptr<char[]>> arena;
+	char* arena_next;
+	size_t arena_left;
+
+	std::vector<Slot> slots;        // size is a power of two, at most half full
+	std::vector<std::string_view> names;
+};
+
+// Something per symbol, nullptr - nothing for that id
+template <typename T>
+class SymbolIndex
+{
+public:
+
+	T* get(int id) const
+	{
+		return id >= 0 && static_cast<size_t>(id) < items.size() ? items[id] : nullptr;
+	}
+
+	void set(int id, T* item)
+	{
+		if (static_cast<size_t>(id) >= items.size())
+			items.resize(id + 1, nullptr);
+		items[id] = item;
+	}
+
+	void clear()
+	{
+		items.clear();
+	}
+
+private:
+
+	std::vector<T*> items;
+};
@@ -1,6 +1,14 @@
 
 #include "utils.h"
 
+#ifdef _WIN32
+#include <process.h>
+static unsigned long processId() { return static_cast<unsigned long>(_getpid()); }
+#else
+#include <unistd.h>
+static unsigned long processId() { return static_cast<unsigned long>(getpid()); }
+#endif
+
 std::string trim(const std::string& str)
 {
     const std::string whitespace = " \t\n\r\f\v";
@@ -12,204 +20,121 @@ std::string trim(const std::string& str)
 }
 
 
-std::string delete_comments(const std::string& line)
+std::string_view trim_view(std::string_view str)
 {
-    std::string clean_line = line;
-    size_t comment_pos = clean_line.find("//");
-    if (comment_pos != std::string::npos) {
-        clean_line = clean_line.substr(0, comment_pos);
-    }
-    return clean_line;
+    const char* whitespace = " \t\n\r\f\v";
+    size_t start = str.find_first_not_of(whitespace);
+    if (start == std::string_view::npos) return {};
+
+    size_t end = str.find_last_not_of(whitespace);
+    return str.substr(start, end - start + 1);
 }
 
-std::list<std::string> parse_preprocess_directive(const std::string& line)
+uint64_t content_hash(std::string_view data, uint64_t seed)
 {
-    std::list<std::string> tokens;
-    std::stringstream ss(line);
-    std::string token;
-
-    while (ss >> token)
+    uint64_t h = seed;
+    for (char c : data)
     {
-        if (!token.empty())
-        {
-            tokens.push_back(token);
-        }
+        h ^= static_cast<uint8_t>(c);
+        h *= 1099511628211ull;
     }
-
-    return tokens;
+    return h;
 }
 
-std::list<std::string> parse_instruction(const std::string& line)
+bool file_content_hash(const std::string& filename, uint64_t& hash)
 {
-    std::list<std::string> tokens;
-
-    std::string clean_line = line;
-
-    std::stringstream ss(clean_line);
-    std::string token;
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+        return false;
 
-    if (ss)
-    {
-        ss >> token;
-        tokens.push_back(token);
-    }
+    std::vector<char> buffer(1024 * 1024);
+    hash = content_hash({});
 
-    while (std::getline(ss, token, ','))
+    while (file)
     {
-        token = trim(token);
-        tokens.push_back(token);
+        file.read(buffer.data(), buffer.size());
+        hash = content_hash(std::string_view(buffer.data(), static_cast<size_t>(file.gcount())), hash);
     }
 
-    return tokens;
+    return !file.bad();
 }
 
-
-
-std::list<std::string> parse_directiveData(const std::string& line)
+bool parse_directiveString(std::string_view line, std::string_view& content)
 {
-    std::list<std::string> tokens;
-    std::stringstream ss(line);
-    std::string token;
+    Lexer lexer(line);
+    Token directive;
 
-    ss >> token;
-
-    std::string values;
-    std::getline(ss, values);
-
-    size_t start = values.find_first_not_of(" \t");
-    if (start != std::string::npos) 
+    if (!lexer.next(directive) || directive.text != ".string")
     {
-        values = values.substr(start);
+        return false;
     }
 
-    std::stringstream values_ss(values);
-    std::string value_token;
+    std::string_view rest = trim_view(lexer.rest());
 
-    while (std::getline(values_ss, value_token, ',')) 
+    if (rest.length() < 2 || rest[0] != '"' || rest[rest.length() - 1] != '"')
     {
-        std::string trimmed = trim(value_token);
-        if (!trimmed.empty()) 
-        {
-            tokens.push_back(trimmed);
-        }
+        return false;
     }
 
-    return tokens;
+    content = rest.substr(1, rest.length() - 2);
+    return true;
 }
 
-std::list<std::string> parse_directiveString(const std::string& line)
+bool parse_directiveLoadFile(std::string_view line, std::string_view& filename)
 {
-    std::list<std::string> tokens;
-    std::stringstream ss(line);
-    std::string token;
-
-    ss >> token;
-    if (token != ".string") 
-    {
-        return tokens;
-    }
-
-    std::string rest;
-    std::getline(ss, rest);
-    rest = trim(rest);
+    Lexer lexer(line);
+    Token directive;
 
-    if (rest.length() < 2 || rest[0] != '"' || rest[rest.length() - 1] != '"')
-    {
-        return tokens;
+    if (!lexer.next(directive) || directive.text != ".include_bin") {
+        return false;
     }
 
-    std::string str_content = rest.substr(1, rest.length() - 2);
-    tokens.push_back(str_content);
-
-    return tokens;
+    filename = trim_view(lexer.rest());
+    return !filename.empty();
 }
 
-std::list<std::string> parse_directiveLoadFile(const std::string& line)
+bool parse_define(std::string_view line, std::string_view& name, std::string& value)
 {
-    std::list<std::string> tokens;
-    std::stringstream ss(line);
-    std::string token;
+    Lexer lexer(line);
+    Token tok;
 
-    ss >> token;
-    if (token != ".include_bin") {
-        return tokens;
-    }
+    value.clear();
 
-    std::string filename;
-    std::getline(ss, filename);
-    filename = trim(filename);
+    lexer.next(tok); // #define
 
-    if (!filename.empty())
+    if (!lexer.next(tok))
     {
-        tokens.push_back(filename);
+        return false;
     }
 
-    return tokens;
-}
-
-std::list<std::string> parse_macro_definition(const std::string& line) {
-    std::list<std::string> tokens;
-    std::string token;
-    bool in_quotes = false;
-    char quote_char = 0;
-
-    for (size_t i = 0; i < line.length(); ++i) {
-        char c = line[i];
+    name = tok.text;
 
-        if (in_quotes) {
-            token += c;
-            if (c == quote_char) {
-                in_quotes = false;
-            }
-        }
-        else {
-            if (c == '"' || c == '\'') {
-                in_quotes = true;
-                quote_char = c;
-                token += c;
-            }
-            else if (c == ',' || c == ' ' || c == '\t') {
-                if (!token.empty()) {
-                    tokens.push_back(token);
-                    token.clear();
-                }
-            }
-            else {
-                token += c;
-            }
+    // value is the rest of the line with whitespace runs collapsed
+    bool space = false;
+    for (char c : lexer.rest())
+    {
+        if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            space = true;
+            continue;
         }
+        if (space && !value.empty())
+            value.push_back(' ');
+        space = false;
+        value.push_back(c);
     }
 
-    if (!token.empty()) {
-        tokens.push_back(token);
-    }
-
-    return tokens;
+    return true;
 }
 
-std::list<std::string> parse_define(const std::string& line)
+std::string parse_include(std::string_view line)
 {
-    std::stringstream ss(line);
-    std::list<std::string> tokens;
-    std::string buf;
-
-    ss >> buf;
-
-    while (ss >> buf)
-    {
-        tokens.push_back(buf);
-    }
-
-    return tokens;
-}
+    Lexer lexer(line);
+    Token command;
 
-std::string parse_include(const std::string& line)
-{
-    std::stringstream ss(line);
-    std::string command, filename;
+    lexer.next(command);
 
-    ss >> command;
-    ss >> filename;
+    std::string_view filename = lexer.rest();
 
     if (filename.empty()) 
     {
@@ -217,77 +142,24 @@ std::string parse_include(const std::string& line)
     }
 
     //  
-    if (filename.size() >= 2 &&
-        filename.front() == '"' &&
-        filename.back() == '"')
-    {
-        return filename.substr(1, filename.length() - 2);
-    }
-
-    return trim(filename);
-}
-
-std::list<std::string> parse_if(const std::string& line)
-{
-    std::stringstream ss(line);
-    std::list<std::string> tokens;
-    std::string buf;
-
-    while (ss >> buf)
+    if (filename.front() == '"')
     {
-        tokens.push_back(buf);
-    }
-    
-    return tokens;
-}
-
-std::string extract_macro_name(const std::string& line) {
-    auto tokens = parse_preprocess_directive(line.substr(1));
-    if (tokens.size() < 2) return ""; 
+        size_t end = filename.find('"', 1);
+        if (end == std::string_view::npos)
+            return {};
 
-    std::string name = tokens.front();
-    tokens.pop_front();
-
-    name = tokens.front();
-
-    if (!isValidIdentifier(name)) {
-        return "";
+        return std::string(filename.substr(1, end - 1));
     }
 
-    return name;
-}
-
-std::string get_preprocessor_directive(const std::string& line)
-{
-    if (line.empty() || line[0] != '#') return "";
-
-    size_t start = line.find_first_not_of(" \t", 1);
-    if (start == std::string::npos) return "";
-
-    size_t end = line.find_first_of(" \t", start);
-    if (end == std::string::npos) {
-        return line.substr(start);
-    }
-    return line.substr(start, end - start);
+    return std::string(filename.substr(0, filename.find_first_of(" \t")));
 }
 
-std::list<std::string> split_text_to_lines(const std::string& text, bool trim_lines, bool del_comms)
+std::string_view extract_macro_name(const TokenList& tokens)
 {
-    std::list<std::string> lines;
-    std::stringstream ss(text);
-    std::string line;
+    if (tokens.count < 2 || !isValidIdentifier(tokens[1].text))
+        return {};
 
-    while (std::getline(ss, line))
-    {
-        if (del_comms)
-            line = delete_comments(line);
-        if (trim_lines)
-        {
-            line = trim(line);
-        }
-        lines.push_back(line);
-    }
-    return lines;
+    return tokens[1].text;
 }
 
 bool is_intersect(int x, int x_size, int y, int y_size)
@@ -301,7 +173,7 @@ bool is_intersect(int x, int x_size, int y, int y_size)
     return (x0 <= y1) && (y0 <= x1);
 }
 
-bool isLabel(std::string token, bool is_arg) {
+bool isLabel(std::string_view token, bool is_arg) {
 
     if (token.empty())
         return false;
@@ -319,18 +191,17 @@ bool isLabel(std::string token, bool is_arg) {
 }
 
 
-bool isDirective(const std::string& line)
+bool isDirective(const TokenList& tokens, AssemblerDirective& directive)
 {
+    if (tokens.kind(0) != TOKEN_DIRECTIVE)
+        return false;
 
-    std::stringstream ss(line);
-    std::string directive;
-
-    ss >> directive;
-
-    if (directive.empty() || directive[0] != '.')
+    const AssemblerDirective* found = ASSEMBLER_DIRECTIVES.find(tokens[0].text.substr(1));
+    if (!found)
         return false;
 
-    return ASSEMBLER_DIRECTIVES.find(directive.substr(1)) != ASSEMBLER_DIRECTIVES.end();
+    directive = *found;
+    return true;
 }
 
 bool isMacro(const std::string& token)
@@ -338,12 +209,12 @@ bool isMacro(const std::string& token)
     return false;
 }
 
-bool isOpcode(const std::string& token, INSTRUCTION_META& meta)
+bool isOpcode(std::string_view token, INSTRUCTION_META& meta)
 {
-    auto it = INSTRUCTIONS.find(token);
+    const INSTRUCTION_META* found = INSTRUCTIONS.find(token);
 
-    if (it != INSTRUCTIONS.end()) {
-        meta = it->second;
+    if (found) {
+        meta = *found;
         return true;
     }
 
@@ -351,20 +222,22 @@ bool isOpcode(const std::string& token, INSTRUCTION_META& meta)
     return false;
 }
 
-bool isRegister(const std::string& token, int& regnum)
+bool isRegister(std::string_view token, int& regnum)
 {
-    auto it = REGISTERS.find(token);
-
     regnum = 0;
-    if (it == REGISTERS.end())
-    {
+
+    if (token.size() != 2 || token[0] != 'R')
         return false;
-    }
-    regnum = it->second;
+
+    int num = token[1] - '0';
+    if (num < 0 || num >= REGISTERS_COUNT)
+        return false;
+
+    regnum = num;
     return true;
 }
 
-bool readFile(const std::string& filename, std::string& source_code, bool verbose)
+bool readFile(const std::string& filename, std::string& source_code, ErrorLog& log, bool verbose)
 {
     qprintf(verbose, 1, __func__);
 
@@ -372,7 +245,7 @@ bool readFile(const std::string& filename, std::string& source_code, bool verbos
 
     if (!file.is_open())
     {
-        error_log.addError(ErrorLog::FILE_CANNOT_OPEN, filename, -1);
+        log.addError(ErrorLog::FILE_CANNOT_OPEN, filename, -1);
         return false;
     }
 
@@ -381,7 +254,7 @@ bool readFile(const std::string& filename, std::string& source_code, bool verbos
 
     if (file.fail())
     {
-        error_log.addError(ErrorLog::FILE_CANNOT_READ, "\nCannot determine file size: " + filename, -1);
+        log.addError(ErrorLog::FILE_CANNOT_READ, "\nCannot determine file size: " + filename, -1);
         return false;
     }
 
@@ -391,7 +264,7 @@ bool readFile(const std::string& filename, std::string& source_code, bool verbos
 
     if (!file.good() && file.gcount() != static_cast<std::streamsize>(size))
     {
-        error_log.addError(ErrorLog::FILE_CANNOT_READ, filename, -1);
+        log.addError(ErrorLog::FILE_CANNOT_READ, filename, -1);
         return false;
     }
 
@@ -403,7 +276,24 @@ bool readFile(const std::string& filename, std::string& source_code, bool verbos
 }
 
 
-bool writeFile(const std::vector<instruction_t>& instructions, std::string output_file, bool verbose, bool verilog_style)
+bool readWholeFile(const std::string& filename, std::string& data)
+{
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+        return false;
+
+    std::streamsize size = file.tellg();
+    if (size < 0)
+        return false;
+
+    data.assign(static_cast<size_t>(size), '\0');
+    file.seekg(0, std::ios::beg);
+    file.read(&data[0], size);
+
+    return file.gcount() == size;
+}
+
+bool writeFile(const std::vector<instruction_t>& instructions, std::string output_file, ErrorLog& log, bool verbose, bool verilog_style)
 {
     qprintf(verbose, 1, "%s\n%s", __func__, output_file.c_str());
 
@@ -424,7 +314,7 @@ bool writeFile(const std::vector<instruction_t>& instructions, std::string outpu
         if (verbose)
             std::cout << "Fail" << std::endl;
 
-        error_log.addError(
+        log.addError(
             ErrorLog::FILE_CANNOT_OPEN,
             output_file,
             -1
@@ -474,7 +364,7 @@ bool writeFile(const std::vector<instruction_t>& instructions, std::string outpu
         if (verbose)
             std::cout << "Fail" << std::endl;
 
-        error_log.addError(
+        log.addError(
             ErrorLog::FILE_CANNOT_WRITE,
             output_file,
             -1
@@ -489,14 +379,14 @@ bool writeFile(const std::vector<instruction_t>& instructions, std::string outpu
     return true;
 }
 
-bool writeFile(const std::string& filename, const std::string& str, bool verbose)
+bool writeFile(const std::string& filename, const std::string& str, ErrorLog& log, bool verbose)
 {
     qprintf(verbose, 1, "Writing to file: %s\n", filename.c_str());
 
     std::ofstream file(filename);
     if (!file.is_open())
     {
-        error_log.addError(ErrorLog::FILE_CANNOT_OPEN, filename, -1);
+        log.addError(ErrorLog::FILE_CANNOT_OPEN, filename, -1);
         return false;
     }
 
@@ -506,142 +396,248 @@ bool writeFile(const std::string& filename, const std::string& str, bool verbose
     return true;
 }
 
-bool isValue8(const std::string& token, int& value)
+// Batch jobs, -pch and -cache runs write next to each other, in this
+// process and in others - the pid and a per-process count keep them apart
+std::string tempFileName(const std::string& filename)
 {
-    if (token.empty())
-        return false;
+    static std::atomic<unsigned long long> counter{ 0 };
+
+    return filename + qsprintf(".%lx.%llx.%llx.tmp",
+        processId(),
+        static_cast<unsigned long long>(std::chrono::steady_clock::now().time_since_epoch().count()),
+        counter.fetch_add(1, std::memory_order_relaxed));
+}
 
-    try {
-        size_t pos = 0;
-        value = std::stoi(token, &pos, 0);
+bool writeFileAtomic(const std::string& filename, std::string_view data)
+{
+    std::string tmp_filename = tempFileName(filename);
+    bool written = false;
 
-        return (pos == token.length()) && (value >= -128) && (value <= 255);
+    {
+        std::ofstream file(tmp_filename, std::ios::binary);
+        if (file.is_open())
+        {
+            file.write(data.data(), data.size());
+            file.close();
+            written = !file.fail();
+        }
     }
-    catch (...) {
+
+    std::error_code ec;
+    if (!written)
+    {
+        // a failed write must not leave its .tmp in a cache directory
+        std::filesystem::remove(tmp_filename, ec);
         return false;
     }
-}
 
-bool isValue16(const std::string& token, int& value)
-{
-    if (token.empty())
+    std::filesystem::rename(tmp_filename, filename, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tmp_filename, ec);
         return false;
+    }
 
-    try {
-        size_t pos = 0;
-        value = std::stoi(token, &pos, 0);
+    return true;
+}
 
-        return (pos == token.length()) && (value >= -32768) && (value <= 65535);
+static bool parse_char_literal(std::string_view token, Literal& literal)
+{
+    // 'c' or '\c'
+    if (token.size() == 3 && token[1] != '\\' && token[1] != '\'')
+    {
+        literal.value = static_cast<uint8_t>(token[1]);
+        return true;
     }
-    catch (...) {
+
+    if (token.size() != 4 || token[1] != '\\')
+        return false;
+
+    switch (token[2])
+    {
+    case '0':  literal.value = '\0'; break;
+    case 'n':  literal.value = '\n'; break;
+    case 'r':  literal.value = '\r'; break;
+    case 't':  literal.value = '\t'; break;
+    case '\\': literal.value = '\\'; break;
+    case '\'': literal.value = '\''; break;
+    case '"':  literal.value = '"';  break;
+    default:
         return false;
     }
+
+    return true;
 }
 
-bool isValue32(const std::string& token, int& value)
+bool parse_literal(std::string_view token, Literal& literal)
 {
+    literal = { LITERAL_NONE, 0 };
+
     if (token.empty())
         return false;
 
-    try {
-        size_t pos = 0;
-        value = std::stoi(token, &pos, 0);
+    if (token.front() == '\'')
+    {
+        if (token.size() < 3 || token.back() != '\'' || !parse_char_literal(token, literal))
+            return false;
+
+        literal.kind = LITERAL_CHAR;
+        return true;
+    }
 
-        return (pos == token.length()) && (value >= -2147483648) && (value <= 4294967295);
+    bool negative = false;
+    if (token.front() == '-' || token.front() == '+')
+    {
+        negative = token.front() == '-';
+        token.remove_prefix(1);
     }
-    catch (...) {
+
+    // cheap reject for registers and labels
+    if (token.empty() || token.front() < '0' || token.front() > '9')
         return false;
+
+    LiteralKind kind = LITERAL_DECIMAL;
+    int base = 10;
+
+    if (token.size() > 1 && token[0] == '0')
+    {
+        switch (token[1])
+        {
+        case 'x': case 'X': kind = LITERAL_HEX;    base = 16; token.remove_prefix(2); break;
+        case 'b': case 'B': kind = LITERAL_BINARY; base = 2;  token.remove_prefix(2); break;
+        default:            kind = LITERAL_OCTAL;  base = 8;  token.remove_prefix(1); break;
+        }
+
+        if (token.empty())
+            return false;
     }
-}
 
+    uint64_t magnitude = 0;
+    const char* end = token.data() + token.size();
+    auto res = std::from_chars(token.data(), end, magnitude, base);
 
-bool isPreprocessDirective(const std::string& line)
-{
-    if (line.empty())
+    if (res.ec != std::errc() || res.ptr != end)
         return false;
 
-    if (line[0] != '#')
+    // anything wider than 32 bits is out of every directive's range anyway
+    if (magnitude > 0xFFFFFFFFull)
         return false;
 
-    auto tokens = parse_preprocess_directive(line);
+    literal.kind = kind;
+    literal.value = negative ? -static_cast<int64_t>(magnitude) : static_cast<int64_t>(magnitude);
+    return true;
+}
 
-    if (tokens.empty())
-        return false;
+bool Literal::in_range(int bits) const
+{
+    // both signed and unsigned interpretations are accepted
+    int64_t min = -(int64_t(1) << (bits - 1));
+    int64_t max = (int64_t(1) << bits) - 1;
 
-    const auto& directive = tokens.front();
+    return kind != LITERAL_NONE && value >= min && value <= max;
+}
 
-    if (directive.empty() || directive[0] != '#')
-    {
+static bool isValue(std::string_view token, int& value, int bits)
+{
+    Literal literal;
+
+    if (!parse_literal(token, literal))
         return false;
-    }
 
-    std::string cleanDirective = directive.substr(1);
-    return PREPROCESSOR_DIRECTIVES.find(cleanDirective) != PREPROCESSOR_DIRECTIVES.end();
+    value = static_cast<int>(static_cast<uint32_t>(literal.value));
+    return literal.in_range(bits);
 }
 
-bool isInstruction(const std::string& line)
+bool isValue8(std::string_view token, int& value)
 {
-    std::stringstream ss(line);
-    std::string opcode;
-
-    ss >> opcode;
+    return isValue(token, value, 8);
+}
 
-    INSTRUCTION_META meta;
+bool isValue16(std::string_view token, int& value)
+{
+    return isValue(token, value, 16);
+}
 
-    return isOpcode(opcode, meta);
+bool isValue32(std::string_view token, int& value)
+{
+    return isValue(token, value, 32);
 }
 
-bool isValidInstruction(const std::string& line)
+
+bool isPreprocessDirective(const TokenList& tokens, PreprocessorDirective& directive)
 {
+    if (tokens.kind(0) != TOKEN_PREPROCESSOR)
+        return false;
+
+    const PreprocessorDirective* found = PREPROCESSOR_DIRECTIVES.find(tokens[0].text.substr(1));
+    if (!found)
+        return false;
 
-    if (line[line.length() - 1] == ',')
+    directive = *found;
+    return true;
+}
+
+bool peekPreprocessDirective(std::string_view line, PreprocessorDirective& directive)
+{
+    if (line.size() < 2 || line[0] != '#')
         return false;
 
-    auto tokens = parse_instruction(line);
+    size_t end = 1;
+    while (end < line.size() && (std::isalnum(static_cast<unsigned char>(line[end])) || line[end] == '_'))
+        end++;
 
-    if (tokens.empty())
+    const PreprocessorDirective* found = PREPROCESSOR_DIRECTIVES.find(line.substr(1, end - 1));
+    if (!found)
         return false;
 
-    INSTRUCTION_META meta;
+    directive = *found;
+    return true;
+}
 
-    std::string opcode = tokens.front();
-    tokens.pop_front();
+bool isInstruction(const TokenList& tokens)
+{
+    return tokens.kind(0) == TOKEN_OPCODE;
+}
 
-    if (!isOpcode(opcode, meta))
+bool isValidInstruction(const TokenList& tokens)
+{
+    if (tokens.empty() || tokens.truncated)
         return false;
 
-    if (meta.opcode_args_num != tokens.size())
-    {
+    if (tokens.kind(tokens.count - 1) == TOKEN_COMMA)
         return false;
-    }
 
-    for (int i = 0; i < meta.opcode_args_num; i++)
+    INSTRUCTION_META meta;
+
+    if (!isOpcode(tokens[0].text, meta))
+        return false;
+
+    TokenReader reader(tokens, 1);
+    Token arg;
+    int args_num = 0;
+
+    while (reader.nextOperand(arg))
     {
-        std::string arg = tokens.front();
-        tokens.pop_front();
+        if (++args_num > meta.opcode_args_num)
+            return false;
 
-        if (opcode == "LWI" && i == 1)
+        if (meta.opcode_code == OPCODE_LWI && args_num == 2)
         {
             int value;
-            if (!(isValue16(arg, value) ||
-                isLabel(arg, true)))
+            if (!(isValue16(arg.text, value) ||
+                isLabel(arg.text, true)))
                 return false;
         }
-        else
+        else if (arg.kind != TOKEN_REGISTER)
         {
-            int regnum;
-            if (!isRegister(arg, regnum))
-            {
-                return false;
-            }
+            return false;
         }
-
     }
 
-    return true;
+    return meta.opcode_args_num == args_num;
 }
 
-bool isValidIdentifier(const std::string& token)
+bool isValidIdentifier(std::string_view token)
 {
     if (token.empty())
         return false;
@@ -659,7 +655,7 @@ bool isValidIdentifier(const std::string& token)
     return true;
 }
 
-bool isEntryPoint(const std::string& token, bool check_label)
+bool isEntryPoint(std::string_view token, bool check_label)
 {
     if (!check_label)
     {
@@ -685,9 +681,9 @@ std::string instructionToBinaryString(instruction_t instruction)
 }
 
 
-int getOpcodeSize(const std::string& opcode)
+int getOpcodeSize(int opcode_code)
 {
-    return opcode == "LWI" ? 2 : 1;
+    return opcode_code == OPCODE_LWI ? 2 : 1;
 }
 
 std::vector<std::string> splitLines(const std::string& str) {
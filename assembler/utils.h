@@ -1,33 +1,60 @@
 #pragma once
 
 #include "common.h"
+#include "lexer.h"
 
 // ============================================================================
 // TEXT PROCESSING AND UTILITY FUNCTIONS
 // ============================================================================
 
 std::string trim(const std::string& s);
-std::string delete_comments(const std::string& s);
+std::string_view trim_view(std::string_view s);
+
+// 64-bit FNV-1a, for change detection of file contents
+uint64_t content_hash(std::string_view data, uint64_t seed = 14695981039346656037ull);
+// content_hash of a file, read in blocks
+bool file_content_hash(const std::string& filename, uint64_t& hash);
 std::vector<std::string> splitLines(const std::string& str);
-std::list<std::string> split_text_to_lines(const std::string& text, bool trim_lines, bool del_comms = true);
 
 // ============================================================================
 // PARSING FUNCTIONS
 // ============================================================================
 
-std::list<std::string> parse_instruction(const std::string& line);
-std::list<std::string> parse_preprocess_directive(const std::string& line);
-std::list<std::string> parse_directiveData(const std::string& line);
-std::list<std::string> parse_directiveString(const std::string& line);
-std::list<std::string> parse_directiveLoadFile(const std::string& line);
-std::list<std::string> parse_macro_definition(const std::string& line);
+typedef bool (*value_check_t)(std::string_view token, int& value);
+
+// Calls on_value for every comma separated value of a data directive.
+// Empty values are skipped; fails on the first value rejected by check.
+template <class OnValue>
+bool parse_directiveData(std::string_view line, value_check_t check, OnValue on_value)
+{
+	Lexer lexer(line);
+	Token tok;
+
+	lexer.next(tok); // directive
+
+	while (lexer.nextOperand(tok))
+	{
+		int value;
+
+		if (tok.kind == TOKEN_NONE)
+			continue;
+
+		if (!check(tok.text, value))
+			return false;
+
+		on_value(value);
+	}
+
+	return true;
+}
 
-std::list<std::string> parse_define(const std::string& line);
-	      std::string  parse_include(const std::string& line);
-std::list<std::string> parse_if (const std::string& line);
+bool parse_directiveString(std::string_view line, std::string_view& content);
+bool parse_directiveLoadFile(std::string_view line, std::string_view& filename);
 
-std::string extract_macro_name(const std::string& line);
-std::string get_preprocessor_directive(const std::string& line);
+bool parse_define(std::string_view line, std::string_view& name, std::string& value);
+std::string parse_include(std::string_view line);
+
+std::string_view extract_macro_name(const TokenList& tokens);
 
 
 // ============================================================================
@@ -37,26 +64,56 @@ std::string get_preprocessor_directive(const std::string& line);
 bool is_intersect(int x, int x_size, int y, int y_size);
 instruction_t packInstruction(int opcode, int rd, int rs, int rt);
 std::string instructionToBinaryString(instruction_t instruction);
-int getOpcodeSize(const std::string& opcode);
+int getOpcodeSize(int opcode_code);
+
+// ============================================================================
+// NUMERIC LITERALS
+// ============================================================================
+
+enum LiteralKind
+{
+	LITERAL_NONE = 0,
+	LITERAL_DECIMAL,	// 42, -5
+	LITERAL_HEX,		// 0x2A
+	LITERAL_BINARY,		// 0b101010
+	LITERAL_OCTAL,		// 052
+	LITERAL_CHAR,		// 'A', '\n'
+};
+
+struct Literal
+{
+	LiteralKind kind;
+	int64_t value;
+
+	// fits into bits wide word, signed or unsigned
+	bool in_range(int bits) const;
+};
+
+// Allocation and exception free, non-numeric tokens are rejected
+// after a couple of compares
+bool parse_literal(std::string_view token, Literal& literal);
 
 // ============================================================================
 // TOKEN IDENTIFICATION AND VALIDATION
 // ============================================================================
 
-bool isDirective(const std::string& line);
-bool isInstruction(const std::string& line);
-bool isPreprocessDirective(const std::string& line);
+bool isDirective(const TokenList& tokens, AssemblerDirective& directive);
+bool isInstruction(const TokenList& tokens);
+bool isPreprocessDirective(const TokenList& tokens, PreprocessorDirective& directive);
+// Directive of a trimmed line, found by its first word only - no tokenizing
+bool peekPreprocessDirective(std::string_view line, PreprocessorDirective& directive);
 bool isPreprocessMacros(const std::string& line);
-bool isValidInstruction(const std::string& line);
+bool isValidInstruction(const TokenList& tokens);
 bool isMacro(const std::string& token);
-bool isOpcode(const std::string& token, INSTRUCTION_META& meta);
-bool isRegister(const std::string& token, int& regnum);
-bool isValue8(const std::string& token, int& value);
-bool isValue16(const std::string& token, int& value);
-bool isValue32(const std::string& token, int& value);
-bool isLabel(std::string token, bool is_arg);
-bool isEntryPoint(const std::string& token, bool check_label = true);
-bool isValidIdentifier(const std::string& token);
+bool isOpcode(std::string_view token, INSTRUCTION_META& meta);
+bool isRegister(std::string_view token, int& regnum);
+
+bool isValue8(std::string_view token, int& value);
+bool isValue16(std::string_view token, int& value);
+bool isValue32(std::string_view token, int& value);
+bool isLabel(std::string_view token, bool is_arg);
+bool isEntryPoint(std::string_view token, bool check_label = true);
+bool isValidIdentifier(std::string_view token);
 
 // ============================================================================
 // DEBUGGING AND OUTPUT UTILITIES
@@ -65,7 +122,14 @@ bool isValidIdentifier(const std::string& token);
 void qprintf(bool verbose, int level, const char* format, ...);
 std::string qsprintf(const char* format, ...);
 
-bool writeFile(const std::vector<instruction_t>& data, std::string output_file, bool verbose, bool verilog_style = false);
-bool writeFile(const std::string& filename, const std::string& str, bool verbose);
-
-bool readFile(const std::string& filename, std::string& source_code, bool verbose);
\ No newline at end of file
+bool writeFile(const std::vector<instruction_t>& data, std::string output_file, ErrorLog& log, bool verbose, bool verilog_style = false);
+bool writeFile(const std::string& filename, const std::string& str, ErrorLog& log, bool verbose);
+// Unique name next to filename for writing before a rename
+std::string tempFileName(const std::string& filename);
+// Writes to a temporary file and renames it over filename, so readers
+// never see a partial file. Failures are silent - used for caches
+bool writeFileAtomic(const std::string& filename, std::string_view data);
+
+bool readFile(const std::string& filename, std::string& source_code, ErrorLog& log, bool verbose);
+// Whole file as it is, no log - a missing or unreadable file is a cache miss
+bool readWholeFile(const std::string& filename, std::string& data);
\ No newline at end of file
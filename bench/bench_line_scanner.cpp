@@ -0,0 +1,111 @@
+/*
+    Line splitting throughput on a multi-megabyte source.
+
+    Splits the same generated text with std::getline plus the old
+    per-line comment cut, then with every scanLines() kernel the CPU
+    has, and prints MB/s for each. The kernels must agree on every span.
+
+    Build from the repository root:
+        g++ -std=c++17 -O2 -Iassembler bench/bench_line_scanner.cpp assembler/line_scanner.cpp -o bench_line_scanner
+        cl /std:c++17 /O2 /EHsc /Iassembler bench\bench_line_scanner.cpp assembler\line_scanner.cpp
+
+    bench_line_scanner [megabytes, default 64]
+*/
+
+#include "line_scanner.h"
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Instructions, comments, strings and char literals with quotes inside, as in real sources
+static std::string generateSource(size_t bytes)
+{
+    static const char* LINES[] = {
+        "\tLWI R1, 1234 // load the counter\n",
+        "loop_%zu:\n",
+        "\tADD R1, R2, R3\n",
+        "\t.string \"text // not a comment\"\n",
+        "\tLWI R2, '\"' // a quote char\n",
+        "\t\t// a whole line of comment\n",
+        "\tJPR R4\n",
+        "\n",
+    };
+
+    std::string text;
+    text.reserve(bytes + 64);
+
+    char label[64];
+    for (size_t i = 0; text.size() < bytes; i++)
+    {
+        const char* line = LINES[i % (sizeof(LINES) / sizeof(LINES[0]))];
+        snprintf(label, sizeof(label), line, i);
+        text += label;
+    }
+
+    return text;
+}
+
+// What the passes did before the scanner - one std::string per line
+static size_t splitGetline(const std::string& text)
+{
+    std::istringstream in(text);
+    std::string line;
+    size_t count = 0;
+
+    while (std::getline(in, line))
+    {
+        size_t comment = line.find("//");
+        if (comment != std::string::npos)
+            line.erase(comment);
+        count += !line.empty();
+    }
+
+    return count;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t megabytes = argc > 1 ? static_cast<size_t>(std::atoi(argv[1])) : 64;
+    std::string text = generateSource(megabytes << 20);
+    double mb = static_cast<double>(text.size()) / (1 << 20);
+
+    printf("%.1f MB of source\n", mb);
+
+    auto start = std::chrono::steady_clock::now();
+    size_t lines = splitGetline(text);
+    double seconds = secondsSince(start);
+    printf("%-10s %8.3f s %10.1f MB/s (%zu non-empty lines)\n", "getline", seconds, mb / seconds, lines);
+
+    std::vector<LineSpan> reference;
+    ScannerKind best = detectScanner();
+
+    for (int kind = SCANNER_SCALAR; kind <= best; kind++)
+    {
+        std::vector<LineSpan> spans;
+        spans.reserve(reference.size());
+
+        start = std::chrono::steady_clock::now();
+        scanLines(static_cast<ScannerKind>(kind), text, true, true, spans);
+        seconds = secondsSince(start);
+
+        printf("%-10s %8.3f s %10.1f MB/s (%zu lines)\n", scannerName(static_cast<ScannerKind>(kind)), seconds, mb / seconds, spans.size());
+
+        if (kind == SCANNER_SCALAR)
+        {
+            reference = std::move(spans);
+            continue;
+        }
+
+        bool same = spans.size() == reference.size() && std::equal(spans.begin(), spans.end(), reference.begin(),
+            [](const LineSpan& a, const LineSpan& b) { return a.offset == b.offset && a.length == b.length; });
+        if (!same)
+        {
+            printf("%s spans differ from the scalar kernel\n", scannerName(static_cast<ScannerKind>(kind)));
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
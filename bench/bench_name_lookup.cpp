@@ -0,0 +1,113 @@
+/*
+    Opcode, register and directive lookups per second, before and after
+    the perfect hash tables.
+
+    "before" rebuilds the std::map tables the headers had and looks tokens
+    up the way isOpcode() and isRegister() did, "after" uses INSTRUCTIONS,
+    ASSEMBLER_DIRECTIVES and the decoded register name. Both walk the same
+    token stream of opcodes, registers, directives and labels and must find
+    the same number of names.
+
+    Build from the repository root:
+        g++ -std=c++17 -O2 -Iassembler bench/bench_name_lookup.cpp -o bench_name_lookup
+        cl /std:c++17 /O2 /EHsc /Iassembler bench\bench_name_lookup.cpp
+
+    bench_name_lookup [million lookups, default 50]
+*/
+
+#include "common.h"
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// A mix like the first pass sees: mostly opcodes and registers, some labels
+static std::vector<std::string> makeTokens()
+{
+    std::vector<std::string> tokens;
+
+    for (size_t i = 0; i < INSTRUCTIONS.size(); i++)
+        tokens.emplace_back(INSTRUCTIONS[i].name);
+    for (int i = 0; i < REGISTERS_COUNT; i++)
+        tokens.push_back("R" + std::to_string(i));
+    for (size_t i = 0; i < ASSEMBLER_DIRECTIVES.size(); i++)
+        tokens.emplace_back(ASSEMBLER_DIRECTIVES[i].name);
+    for (const char* label : { "loop", "START", "print_string", "R8", "ADDX", "end_of_table" })
+        tokens.emplace_back(label);
+
+    // spread them so the branch predictor does not learn the order
+    std::vector<std::string> stream;
+    uint32_t state = 12345;
+    for (int i = 0; i < 4096; i++)
+    {
+        state = state * 1664525u + 1013904223u;
+        stream.push_back(tokens[(state >> 8) % tokens.size()]);
+    }
+
+    return stream;
+}
+
+struct MapTables
+{
+    std::map<std::string, INSTRUCTION_META> instructions;
+    std::map<std::string, int> registers;
+    std::map<std::string, AssemblerDirective> directives;
+
+    MapTables()
+    {
+        for (size_t i = 0; i < INSTRUCTIONS.size(); i++)
+            instructions[std::string(INSTRUCTIONS[i].name)] = INSTRUCTIONS[i].value;
+        for (int i = 0; i < REGISTERS_COUNT; i++)
+            registers["R" + std::to_string(i)] = i;
+        for (size_t i = 0; i < ASSEMBLER_DIRECTIVES.size(); i++)
+            directives[std::string(ASSEMBLER_DIRECTIVES[i].name)] = ASSEMBLER_DIRECTIVES[i].value;
+    }
+
+    bool find(std::string_view token) const
+    {
+        std::string key(token);
+        return instructions.count(key) || registers.count(key) || directives.count(key);
+    }
+};
+
+static bool findPerfect(std::string_view token)
+{
+    if (INSTRUCTIONS.find(token) || ASSEMBLER_DIRECTIVES.find(token))
+        return true;
+
+    // isRegister()
+    return token.size() == 2 && token[0] == 'R' && token[1] >= '0' && token[1] < '0' + REGISTERS_COUNT;
+}
+
+template <class Find>
+static size_t run(const char* name, const std::vector<std::string>& stream, size_t lookups, Find find)
+{
+    size_t found = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < lookups; i++)
+        found += find(stream[i % stream.size()]);
+    double seconds = secondsSince(start);
+
+    printf("%-14s %8.3f s %8.1f M lookups/s\n", name, seconds, lookups / seconds / 1e6);
+    return found;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t lookups = (argc > 1 ? static_cast<size_t>(std::atoi(argv[1])) : 50) * 1000000;
+    std::vector<std::string> stream = makeTokens();
+    MapTables maps;
+
+    size_t before = run("std::map", stream, lookups, [&](const std::string& t) { return maps.find(t); });
+    size_t after = run("perfect hash", stream, lookups, [](const std::string& t) { return findPerfect(t); });
+
+    if (before != after)
+    {
+        printf("the tables disagree: %zu vs %zu names found\n", before, after);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
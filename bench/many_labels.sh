@@ -0,0 +1,38 @@
+#!/bin/sh
+# Time of a build with many labels, the layout and overlap check scale with it.
+#
+#   bench/many_labels.sh <path to asm> [labels, default 100000]
+#
+# Every label starts a block of two instructions, three words, and the ROM
+# is sized to fit them all with a word to spare, so the run is the full
+# layout without any error output.
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <path to asm> [labels]"
+    exit 2
+fi
+
+ASM=$1
+LABELS=${2:-100000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+awk -v labels="$LABELS" 'BEGIN {
+    print "START:\n\tNOP"
+    for (i = 0; i < labels; i++)
+        printf "label_%d:\n\tLWI R1, label_%d\n\tJPR R1\n", i, (i * 7919) % labels
+}' > "$DIR/labels.asm"
+
+WORDS=$((LABELS * 3 + 2))
+
+start=$(date +%s.%N)
+"$ASM" "$DIR/labels.asm" "$DIR/labels.bin" -rom_size "$WORDS" > "$DIR/run.log"
+status=$?
+end=$(date +%s.%N)
+
+if [ $status -ne 0 ]; then
+    head -20 "$DIR/run.log"
+    exit $status
+fi
+
+echo "$LABELS labels: $(awk -v a="$start" -v b="$end" 'BEGIN { printf "%.3f", b - a }') s"
@@ -0,0 +1,69 @@
+#!/bin/sh
+# Peak RSS and time of a data table build, in memory and with -stream.
+#
+#   bench/stream_rss.sh <path to asm> [megabytes of source, default 100]
+#
+# Generates a START block followed by a .data16/.byte table of the given
+# size, builds it both ways and prints the peak resident set of each run.
+# With -stream the peak should stay flat whatever the table size. Linux
+# only: the peak is VmHWM from /proc, or GNU time when it is installed.
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <path to asm> [megabytes]"
+    exit 2
+fi
+
+ASM=$1
+MB=${2:-100}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# 8 .data16 words per line, every 8th line a .byte line of 8 bytes (4 words)
+awk -v bytes=$((MB * 1024 * 1024)) 'BEGIN {
+    print "START:\n\tNOP\n\tHLT\nTABLE:"
+    size = 0; words = 2
+    for (i = 0; size < bytes; i++) {
+        if (i % 8 == 7) {
+            line = sprintf("\t.byte %d, %d, %d, %d, %d, %d, %d, %d", i % 256, (i + 1) % 256, (i + 2) % 256, (i + 3) % 256, (i + 4) % 256, (i + 5) % 256, (i + 6) % 256, (i + 7) % 256)
+            words += 4
+        } else {
+            line = sprintf("\t.data16 %d, %d, %d, %d, %d, %d, %d, %d", i % 65536, (i * 3) % 65536, (i * 5) % 65536, (i * 7) % 65536, (i * 11) % 65536, (i * 13) % 65536, (i * 17) % 65536, (i * 19) % 65536)
+            words += 8
+        }
+        print line
+        size += length(line) + 1
+    }
+    print words > "/dev/stderr"
+}' > "$DIR/table.asm" 2> "$DIR/words"
+
+WORDS=$(cat "$DIR/words")
+echo "source: $(du -m "$DIR/table.asm" | cut -f1) MB, $WORDS words"
+
+# peak_rss <command...> - prints "<peak KB> <seconds>"
+peak_rss()
+{
+    if [ -x /usr/bin/time ]; then
+        /usr/bin/time -f "%M %e" "$@" 2>&1 >/dev/null | tail -1
+        return
+    fi
+
+    start=$(date +%s.%N)
+    "$@" >/dev/null &
+    pid=$!
+    peak=0
+    while kill -0 $pid 2>/dev/null; do
+        hwm=$(awk '/^VmHWM/ { print $2 }' /proc/$pid/status 2>/dev/null)
+        [ -n "$hwm" ] && peak=$hwm
+        sleep 0.01
+    done
+    wait $pid
+    end=$(date +%s.%N)
+    echo "$peak $(awk -v a="$start" -v b="$end" 'BEGIN { printf "%.2f", b - a }')"
+}
+
+for mode in "in memory" "-stream"; do
+    flag=
+    [ "$mode" = "-stream" ] && flag=-stream
+    set -- $(peak_rss "$ASM" "$DIR/table.asm" "$DIR/table.bin" -rom_size "$WORDS" $flag)
+    printf "%-10s peak %6d MB  %s s\n" "$mode" $(($1 / 1024)) "$2"
+done
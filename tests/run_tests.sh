@@ -0,0 +1,33 @@
+#!/bin/sh
+# Runs every test_*.sh next to this script against an assembler binary.
+#
+#   tests/run_tests.sh <path to asm>
+#
+# Each test gets the binary as $ASM and a fresh scratch directory as its
+# working directory, exit code 0 is a pass. stress_assemblers.cpp is a
+# program of its own, built against the sources - see its header.
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <path to asm>"
+    exit 2
+fi
+
+ASM=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+HERE=$(cd "$(dirname "$0")" && pwd)
+export ASM HERE
+
+failed=0
+for test in "$HERE"/test_*.sh; do
+    name=$(basename "$test" .sh)
+    scratch=$(mktemp -d)
+    if (cd "$scratch" && sh "$test") > "$scratch.log" 2>&1; then
+        echo "PASS $name"
+    else
+        echo "FAIL $name"
+        cat "$scratch.log"
+        failed=1
+    fi
+    rm -rf "$scratch" "$scratch.log"
+done
+
+exit $failed
@@ -0,0 +1,142 @@
+/*
+    Independent Preprocessor + Assembler pairs on many threads at once.
+
+    Every source is first preprocessed and assembled on the main thread for
+    reference. Then each of N threads builds all of them R times with fresh
+    instances, in a different order per thread, and every output word and
+    every diagnostic must match the reference. Some sources fail on purpose,
+    so the error logs are compared as well.
+
+    Build from the repository root and run:
+        g++ -std=c++17 -O1 -g -pthread -Iassembler tests/stress_assemblers.cpp \
+            $(ls assembler/*.cpp | grep -v main.cpp) -o stress_assemblers
+        ./stress_assemblers [threads, default 8] [runs per thread, default 20] [inner threads, default 1]
+
+    Add -fsanitize=thread to the g++ line to run it under ThreadSanitizer.
+    Inner threads above 1 also run the parallel passes of every instance.
+*/
+
+#include "preprocessor.h"
+#include "assembler.h"
+
+// room for the big source, past it the overlap report grows with the square of the blocks
+static const int ROM_SIZE = 1 << 20;
+
+struct Result
+{
+    std::string preprocessed;
+    std::vector<instruction_t> rom;
+    std::string errors;
+};
+
+static Result build(const std::string& source, unsigned inner_threads)
+{
+    Result result;
+
+    Preprocessor prepr;
+    result.preprocessed = prepr.preprocess(source);
+    result.errors = prepr.diagnostics().getErrors();
+
+    Assembler asmblr;
+    asmblr.setThreads(inner_threads);
+    result.rom = asmblr.assemble(result.preprocessed, ROM_SIZE);
+    result.errors += asmblr.diagnostics().getErrors();
+
+    return result;
+}
+
+static std::vector<std::string> makeSources()
+{
+    std::vector<std::string> sources;
+
+    // defines, macros with arguments and conditionals
+    sources.push_back(
+        "#define SP_PTR 32765\n"
+        "#macro PUSH_VALUE reg, value\n"
+        "    LWI reg, value\n"
+        "    LWI R6, SP_PTR\n"
+        "    SWD R6, reg\n"
+        "#endmacro\n"
+        "START:\n"
+        "    PUSH_VALUE R1, 10\n"
+        "#ifdef SP_PTR\n"
+        "    PUSH_VALUE R2, 20\n"
+        "#else\n"
+        "    PUSH_VALUE R3, 30\n"
+        "#endif\n"
+        "    HLT\n"
+        "TEXT:\n"
+        "    .string \"stress\"\n");
+
+    // errors in both passes
+    sources.push_back(
+        "START:\n"
+        "    PUSH R1, R2\n"
+        "    LWI R9, 1\n"
+        "#endif\n"
+        "START:\n"
+        "    NOP\n");
+
+    // no entry point
+    sources.push_back(
+        "LOOP:\n"
+        "    JPR R1\n");
+
+    // over 32K lines, enough for the parallel passes: many blocks and data tables
+    std::string big = "START:\n    LWI R1, TABLE_0\n    JPR R1\n";
+    for (int i = 0; i < 12000; i++)
+    {
+        big += "BLOCK_" + std::to_string(i) + ":\n";
+        big += "    LWI R1, BLOCK_" + std::to_string((i * 31) % 12000) + "\n";
+        big += "    ADD R2, R2, R1\n";
+        if (i % 100 == 0)
+            big += "TABLE_" + std::to_string(i / 100) + ":\n    .data16 1, 2, 3, 4\n    .byte 5, 6\n";
+    }
+    sources.push_back(std::move(big));
+
+    return sources;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned threads = argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : 8;
+    int runs = argc > 2 ? std::atoi(argv[2]) : 20;
+    unsigned inner_threads = argc > 3 ? static_cast<unsigned>(std::atoi(argv[3])) : 1;
+
+    std::vector<std::string> sources = makeSources();
+    std::vector<Result> reference;
+    for (const auto& source : sources)
+        reference.push_back(build(source, 1));
+
+    std::atomic<int> mismatches{ 0 };
+    std::atomic<int> builds{ 0 };
+    std::vector<std::thread> workers;
+
+    for (unsigned t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t] {
+            for (int run = 0; run < runs; run++)
+            {
+                for (size_t i = 0; i < sources.size(); i++)
+                {
+                    size_t which = (i + t + run) % sources.size();
+                    Result result = build(sources[which], inner_threads);
+                    builds++;
+
+                    const Result& expected = reference[which];
+                    if (result.preprocessed != expected.preprocessed || result.rom != expected.rom || result.errors != expected.errors)
+                    {
+                        mismatches++;
+                        printf("thread %u run %d: source %zu differs from the reference\n", t, run, which);
+                    }
+                }
+            }
+        });
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+
+    printf("%d builds on %u threads (%u inner), %d mismatches\n", builds.load(), threads, inner_threads, mismatches.load());
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,11 @@
+# A '"' char literal does not open a string, the // comment after it is
+# still cut off before the assembler sees the line
+
+printf "START:\n\tLWI R1, '\"' // a \"quoted\" comment\n\tNOP // done\n" > main.asm
+
+"$ASM" main.asm out.txt -preprocess_out > run.log || { cat run.log; exit 1; }
+
+if grep -q "comment" out.txt.prep; then
+    cat out.txt.prep
+    exit 1
+fi
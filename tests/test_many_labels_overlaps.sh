@@ -0,0 +1,20 @@
+# 5000 labels past a small -rom_size: the overflow leaves the last blocks at
+# address 0 and the overlap report must be the one the pairwise check gave,
+# the same 230 reports in the same order (checksum of the whole output)
+
+awk 'BEGIN {
+    print "START:\n\tNOP"
+    for (i = 0; i < 5000; i++)
+        printf "L%d:\n\tNOP\n\tNOP\n", i
+}' > main.asm
+
+"$ASM" main.asm out.bin -rom_size 9961 > run.log
+
+overlaps=$(grep -c "Blocks overlap" run.log)
+sum=$(cksum < run.log | cut -d' ' -f1,2)
+
+if [ "$overlaps" != 230 ] || [ "$sum" != "2949405976 49982" ]; then
+    echo "$overlaps overlaps, checksum $sum"
+    head -40 run.log
+    exit 1
+fi
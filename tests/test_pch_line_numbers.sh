@@ -0,0 +1,14 @@
+# An error after an #include keeps its own line number when the include
+# comes from a -pch snapshot, on the cold run and on the warm one
+
+printf '#define ANSWER 42\n' > inc.asm
+printf 'main:\nNOP\nNOP\nNOP\n#include "inc.asm"\nNOP\n#endif\n' > main.asm
+
+for run in cold warm; do
+    "$ASM" main.asm out.txt -pch pch > $run.log
+    if ! grep -q "line 7" $run.log; then
+        echo "$run run:"
+        cat $run.log
+        exit 1
+    fi
+done
@@ -0,0 +1,33 @@
+# A -server builds what a run of its own builds, replays header snapshots
+# it kept in memory, and on -stop removes its own socket but nothing the
+# clients had in their directories
+
+mkdir client
+printf '#define ANSWER 42\n#macro TWICE x\n    ADD x, x, x\n#endmacro\n' > client/inc.asm
+printf '#include "inc.asm"\nSTART:\n    LWI R1, ANSWER\n    TWICE R1\n    HLT\n' > client/main.asm
+echo "not a socket" > client/sock
+
+"$ASM" -server sock > server.log 2>&1 &
+server=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S sock ] && break
+    sleep 0.2
+done
+
+cd client
+"$ASM" main.asm own.bin > /dev/null
+"$ASM" -client ../sock main.asm first.bin -verbose > /dev/null
+"$ASM" -client ../sock main.asm second.bin -verbose > /dev/null
+"$ASM" -client ../sock -stop > /dev/null
+cd ..
+wait $server
+
+status=0
+cmp client/own.bin client/first.bin || status=1
+cmp client/own.bin client/second.bin || status=1
+grep -q "SNAPSHOT: " server.log || { echo "no snapshot replayed"; status=1; }
+[ -e sock ] && { echo "server socket left behind"; status=1; }
+[ -f client/sock ] || { echo "client file removed"; status=1; }
+
+[ $status -eq 0 ] || cat server.log
+exit $status